@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+
+# End-to-end benchmarks of the shell. Each benchmark drives ./shell through
+# a pseudo-terminal, just like sh-tests.py does, and measures wall-clock time
+# from sending a command line till the next prompt shows up. Results are
+# printed as JSON, so they can be compared between builds.
+
+import argparse
+import json
+import os
+import pexpect
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+PROMPT = '# '
+
+
+def summary(samples):
+    """ Summarizes latency samples given in seconds as microseconds. """
+    samples = sorted(samples)
+    us = [s * 1e6 for s in samples]
+    return {
+        'count': len(us),
+        'mean': round(statistics.mean(us), 1),
+        'p50': round(us[len(us) // 2], 1),
+        'p99': round(us[min(len(us) - 1, len(us) * 99 // 100)], 1),
+        'max': round(us[-1], 1),
+    }
+
+
+class Shell():
+    def __init__(self, path, timeout):
+        self.child = pexpect.spawn(path, timeout=timeout, maxread=65536,
+                                   encoding='utf-8')
+        self.child.setecho(False)
+        self.child.delaybeforesend = None
+        self.child.expect_exact(PROMPT)
+
+    def run(self, cmd):
+        """ Sends command line and waits for next prompt.
+        Returns output and time elapsed in seconds. """
+        start = time.perf_counter()
+        self.child.sendline(cmd)
+        self.child.expect_exact(PROMPT)
+        return self.child.before, time.perf_counter() - start
+
+    def children(self):
+        """ Returns pids of processes started by the shell. """
+        path = f'/proc/{self.child.pid}/task/{self.child.pid}/children'
+        with open(path) as f:
+            return [int(pid) for pid in f.read().split()]
+
+    def close(self):
+        self.child.sendeof()
+        self.child.expect(pexpect.EOF)
+        self.child.wait()
+
+
+def bench_command(sh, args):
+    """ Throughput of simple external commands. """
+    total = 0.0
+    for _ in range(args.commands):
+        total += sh.run('true')[1]
+    return {'commands': args.commands,
+            'commands_per_sec': round(args.commands / total, 1)}
+
+
+def bench_spawn(sh, args):
+    """ Latency of starting and waiting for N-stage pipeline. """
+    result = {}
+    for n in args.stages:
+        cmd = ' | '.join(['true'] * n)
+        result[str(n)] = summary([sh.run(cmd)[1] for _ in range(args.repeat)])
+    return result
+
+
+def bench_pipe(sh, args):
+    """ Throughput of data flowing through k stages of cat. """
+    result = {}
+    size = args.megabytes << 20
+    for k in args.cats:
+        cmd = ' | '.join([f'head -c {size} /dev/zero'] + ['cat'] * k)
+        elapsed = min(sh.run(cmd + ' > /dev/null')[1] for _ in range(3))
+        result[str(k)] = {'MB_per_sec': round(args.megabytes / elapsed, 1)}
+    return result
+
+
+def bench_fanout(sh, args):
+    """ Throughput of feeding k consumers with fan-out operator, compared to
+    tee(1) writing to a pipe and to FIFOs read by background consumers. """
+    result = {}
+    size = args.megabytes << 20
+    producer = f'head -c {size} /dev/zero'
+    consumer = 'cat > /dev/null'
+    with tempfile.TemporaryDirectory() as tmp:
+        for k in args.consumers:
+            fifos = [os.path.join(tmp, f'fifo{i}') for i in range(1, k)]
+            for fifo in fifos:
+                if not os.path.exists(fifo):
+                    os.mkfifo(fifo)
+
+            def tee():
+                for fifo in fifos:
+                    sh.run(f'cat {fifo} > /dev/null &')
+                return sh.run(f'{producer} | tee {" ".join(fifos)} | '
+                              f'{consumer}')[1]
+
+            native = ' |> '.join([producer] + [consumer] * k)
+            stats = {}
+            for name, run in [('fanout', lambda: sh.run(native)[1]),
+                              ('tee', tee)]:
+                elapsed = min(run() for _ in range(3))
+                stats[name] = {'MB_per_sec': round(args.megabytes / elapsed, 1)}
+            result[str(k)] = stats
+    return result
+
+
+def bench_jobs(sh, args):
+    """ Cost of starting many background jobs, listing and reaping them. """
+    result = {}
+    for n in args.jobs:
+        stats = {}
+        try:
+            start = time.perf_counter()
+            for _ in range(n):
+                sh.run('sleep 3600 &')
+            stats['spawn_per_sec'] = round(n / (time.perf_counter() - start), 1)
+            stats['jobs_usec'] = round(sh.run('jobs')[1] * 1e6, 1)
+        finally:
+            start = time.perf_counter()
+            for pid in sh.children():
+                os.kill(pid, signal.SIGTERM)
+            # Shell reports finished jobs before each prompt.
+            while 'running' in sh.run('jobs')[0]:
+                continue
+            stats['reap_usec'] = round((time.perf_counter() - start) * 1e6, 1)
+        result[str(n)] = stats
+    return result
+
+
+def bench_subst(sh, args):
+    """ Latency of command substitution of a builtin, which is evaluated
+    within the shell, and of an external command. """
+    result = {}
+    for name, cmd in [('builtin', 'echo'), ('external', '/bin/echo')]:
+        line = f'echo $({cmd} x) > /dev/null'
+        result[name] = summary([sh.run(line)[1] for _ in range(args.repeat)])
+    return result
+
+
+def bench_prompt(sh, args):
+    """ Latency of handling an empty line. """
+    return summary([sh.run('')[1] for _ in range(args.prompts)])
+
+
+def bench_startup(sh, args):
+    """ Latency of 'shell -c true' from start till exit. A plain 'true' is
+    timed too, as a baseline of creating a process from here. The median has
+    to fit within the budget. """
+    def run(argv):
+        samples = []
+        for _ in range(args.startups):
+            start = time.perf_counter()
+            subprocess.run(argv, stdin=subprocess.DEVNULL, check=True)
+            samples.append(time.perf_counter() - start)
+        return summary(samples)
+
+    baseline = run(['true'])
+    startup = run([args.shell, '-c', 'true'])
+    return {'startup': startup, 'baseline': baseline,
+            'budget_us': args.startup_budget,
+            'within_budget': startup['p50'] <= args.startup_budget}
+
+
+BENCHMARKS = {
+    'command': bench_command,
+    'spawn': bench_spawn,
+    'pipe': bench_pipe,
+    'fanout': bench_fanout,
+    'jobs': bench_jobs,
+    'subst': bench_subst,
+    'prompt': bench_prompt,
+    'startup': bench_startup,
+}
+
+
+def numbers(s):
+    return [int(n) for n in s.split(',')]
+
+
+def revision():
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'],
+                                       stderr=subprocess.DEVNULL,
+                                       encoding='utf-8').strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Benchmark the shell.')
+    parser.add_argument('benchmarks', nargs='*', default=list(BENCHMARKS),
+                        help=f'any of: {", ".join(BENCHMARKS)}')
+    parser.add_argument('--shell', default='./shell')
+    parser.add_argument('--commands', type=int, default=500)
+    parser.add_argument('--stages', type=numbers, default=[1, 2, 4, 8, 16])
+    parser.add_argument('--repeat', type=int, default=50)
+    parser.add_argument('--cats', type=numbers, default=[1, 2, 4])
+    parser.add_argument('--megabytes', type=int, default=256)
+    parser.add_argument('--consumers', type=numbers, default=[2, 4])
+    parser.add_argument('--jobs', type=numbers, default=[1000, 10000])
+    parser.add_argument('--prompts', type=int, default=1000)
+    parser.add_argument('--startups', type=int, default=1000)
+    parser.add_argument('--startup-budget', type=int, default=10000,
+                        help='median startup time allowed in usec')
+    parser.add_argument('--timeout', type=int, default=60)
+    parser.add_argument('-o', '--output', help='write JSON to this file')
+    args = parser.parse_args()
+    for name in args.benchmarks:
+        if name not in BENCHMARKS:
+            parser.error(f'unknown benchmark: {name}')
+
+    result = {'revision': revision(), 'time': int(time.time()),
+              'shell': args.shell}
+    for name in args.benchmarks:
+        sh = Shell(args.shell, args.timeout)
+        result[name] = BENCHMARKS[name](sh, args)
+        sh.close()
+        print(f'{name}: done', file=sys.stderr)
+
+    out = open(args.output, 'w') if args.output else sys.stdout
+    json.dump(result, out, indent=2)
+    out.write('\n')
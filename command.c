@@ -1,12 +1,72 @@
 #include "shell.h"
+#include <stdarg.h>
 
 typedef int (*func_t)(char **argv);
 
 typedef struct {
   const char *name;
   func_t func;
+  bool pure; /* has no effect on the shell, so it can run anywhere */
 } command_t;
 
+/* Standard output of builtins run by the shell itself. It's a memory buffer
+ * while command substitution is evaluated in-process. */
+static int outfd = STDOUT_FILENO;
+static outbuf_t *outbuf = NULL;
+
+void builtin_output(int fd, outbuf_t *buf) {
+  outfd = fd;
+  outbuf = buf;
+}
+
+void outbuf_append(outbuf_t *buf, const char *data, size_t len) {
+  if (buf->len + len + 1 > buf->cap) {
+    while (buf->len + len + 1 > buf->cap)
+      buf->cap = buf->cap ? buf->cap * 2 : 4096;
+    buf->data = realloc(buf->data, buf->cap);
+  }
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  buf->data[buf->len] = '\0';
+}
+
+void outbuf_printf(outbuf_t *buf, const char *fmt, ...) {
+  char line[256];
+  va_list args;
+
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+
+  if (len < (int)sizeof(line)) {
+    outbuf_append(buf, line, len);
+    return;
+  }
+
+  char *str = malloc(len + 1);
+  va_start(args, fmt);
+  vsnprintf(str, len + 1, fmt, args);
+  va_end(args);
+  outbuf_append(buf, str, len);
+  free(str);
+}
+
+static void output(const char *data, size_t len) {
+  if (outbuf) {
+    outbuf_append(outbuf, data, len);
+    return;
+  }
+
+  while (len > 0) {
+    ssize_t n = write(outfd, data, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return;
+    data += n, len -= n;
+  }
+}
+
 static int do_quit(char **argv) {
   shutdownjobs();
   exit(EXIT_SUCCESS);
@@ -20,7 +80,7 @@ static int do_quit(char **argv) {
 static int do_chdir(char **argv) {
   char *path = argv[0];
   if (path == NULL)
-    path = getenv("HOME");
+    path = (char *)getvar("HOME");
   int rc = chdir(path);
   if (rc < 0) {
     msg("cd: %s: %s\n", strerror(errno), path);
@@ -31,8 +91,22 @@ static int do_chdir(char **argv) {
 
 /*
  * Displays all stopped or running jobs.
+ * 'jobs' print state of jobs
+ * 'jobs -r [seconds]' monitor resources used by jobs until a key is pressed
  */
 static int do_jobs(char **argv) {
+  if (argv[0] && !strcmp(argv[0], "-r")) {
+    double interval = 1.0;
+    char *end = NULL;
+    if (argv[1])
+      interval = strtod(argv[1], &end);
+    if ((end && *end) || !(interval > 0 && interval <= 3600)) {
+      msg("jobs: invalid interval: %s\n", argv[1]);
+      return 1;
+    }
+    return monitorjobs(interval * 1000);
+  }
+
   watchjobs(ALL);
   return 0;
 }
@@ -91,16 +165,177 @@ static int do_kill(char **argv) {
   return 0;
 }
 
+/*
+ * Display shell-internal latency histograms.
+ * 'stats' print all histograms
+ * 'stats reset' clear all histograms
+ */
+static int do_stats(char **argv) {
+  if (argv[0] == NULL) {
+    outbuf_t out = {};
+    stats_print(&out);
+    output(out.data, out.len);
+    free(out.data);
+  } else if (!strcmp(argv[0], "reset")) {
+    stats_reset();
+  } else {
+    msg("stats: unknown argument: %s\n", argv[0]);
+    return 1;
+  }
+  return 0;
+}
+
+/*
+ * Display command history.
+ * 'history' print all commands
+ * 'history text...' print commands containing given text
+ */
+static int do_history(char **argv) {
+  char *pattern = NULL;
+
+  for (; *argv; argv++) {
+    if (pattern)
+      strapp(&pattern, " ");
+    strapp(&pattern, *argv);
+  }
+  outbuf_t out = {};
+  history_print(&out, pattern);
+  output(out.data, out.len);
+  free(out.data);
+  free(pattern);
+  return 0;
+}
+
+/*
+ * Mark variables to be passed to subprocesses.
+ * 'export' print all exported variables
+ * 'export NAME=value...' set and export variables
+ * 'export NAME...' export existing variables
+ */
+static int do_export(char **argv) {
+  if (argv[0] == NULL) {
+    outbuf_t out = {};
+    printvars(&out);
+    output(out.data, out.len);
+    free(out.data);
+    return 0;
+  }
+
+  for (; *argv; argv++) {
+    if (assignment_p(*argv))
+      assign(*argv, true);
+    else
+      setvar(*argv, NULL, true);
+  }
+  return 0;
+}
+
+/*
+ * Remove variables.
+ * 'unset NAME...'
+ */
+static int do_unset(char **argv) {
+  for (; *argv; argv++)
+    unsetvar(*argv);
+  return 0;
+}
+
+/*
+ * Print arguments separated by spaces.
+ * 'echo text...' print text followed by newline
+ * 'echo -n text...' print text only
+ */
+static int do_echo(char **argv) {
+  bool newline = true;
+
+  if (argv[0] && !strcmp(argv[0], "-n"))
+    newline = false, argv++;
+
+  /* Whole text goes out with a single write. */
+  size_t len = 1;
+  for (char **arg = argv; *arg; arg++)
+    len += strlen(*arg) + 1;
+
+  char *text = malloc(len), *p = text;
+  for (char **arg = argv; *arg; arg++) {
+    if (arg != argv)
+      *p++ = ' ';
+    p = stpcpy(p, *arg);
+  }
+  if (newline)
+    *p++ = '\n';
+
+  output(text, p - text);
+  free(text);
+  return 0;
+}
+
+/*
+ * Print current working directory.
+ */
+static int do_pwd(char **argv) {
+  char cwd[PATH_MAX];
+
+  if (getcwd(cwd, sizeof(cwd)) == NULL) {
+    msg("pwd: %s\n", strerror(errno));
+    return 1;
+  }
+  strcat(cwd, "\n");
+  output(cwd, strlen(cwd));
+  return 0;
+}
+
 static command_t builtins[] = {
-  {"quit", do_quit}, {"cd", do_chdir},  {"jobs", do_jobs}, {"fg", do_fg},
-  {"bg", do_bg},     {"kill", do_kill}, {NULL, NULL},
+  {"quit", do_quit},   {"cd", do_chdir},        {"jobs", do_jobs},
+  {"fg", do_fg},       {"bg", do_bg},           {"kill", do_kill},
+  {"stats", do_stats}, {"history", do_history}, {"export", do_export},
+  {"unset", do_unset}, {"echo", do_echo, true}, {"pwd", do_pwd, true},
+  {NULL, NULL},
 };
 
+static command_t *lookup_builtin(char **argv) {
+  while (string_p(*argv) && assignment_p(*argv))
+    argv++;
+  if (!string_p(*argv))
+    return NULL;
+
+  for (command_t *cmd = builtins; cmd->name; cmd++)
+    if (!strcmp(*argv, cmd->name))
+      return cmd;
+  return NULL;
+}
+
+/* Is the command run by the shell itself? */
+bool builtin_p(char **argv) {
+  return lookup_builtin(argv) != NULL;
+}
+
+/* Can the command run within the shell without changing its state? */
+bool pure_builtin_p(char **argv) {
+  command_t *cmd = lookup_builtin(argv);
+  return cmd && cmd->pure;
+}
+
 int builtin_command(char **argv) {
+  int n = 0;
+
+  /* Words of form NAME=value preceding a command are assignments. */
+  while (argv[n] && assignment_p(argv[n]))
+    n++;
+
+  if (argv[n] == NULL) {
+    for (int i = 0; i < n; i++)
+      assign(argv[i], false);
+    return 0;
+  }
+
   for (command_t *cmd = builtins; cmd->name; cmd++) {
-    if (strcmp(argv[0], cmd->name))
+    if (strcmp(argv[n], cmd->name))
       continue;
-    return cmd->func(&argv[1]);
+    pushvars(argv, n);
+    int exitcode = cmd->func(&argv[n + 1]);
+    popvars();
+    return exitcode;
   }
 
   errno = ENOENT;
@@ -108,11 +343,26 @@ int builtin_command(char **argv) {
 }
 
 noreturn void external_command(char **argv) {
-  const char *path = getenv("PATH");
+  stats_record(S_EXECVE, spawn_start);
+
+  /* Assignments preceding the command go to its environment. */
+  for (; *argv && assignment_p(*argv); argv++)
+    assign(*argv, true);
+  if (*argv == NULL)
+    exit(EXIT_SUCCESS);
+
+  const char *path = getvar("PATH");
+  char **envp = getenvp();
 
   if (!index(argv[0], '/') && path) {
     /* TODO: For all paths in PATH construct an absolute path and execve it. */
 #ifdef STUDENT
+    // jezeli indeks PATH zna polecenie wykonujemy je od razu, a w razie
+    // niepowodzenia (nieaktualny indeks) przeszukujemy wszystkie katalogi
+    const char *exe = pathindex_lookup(argv[0]);
+    if (exe)
+      execve(exe, argv, envp);
+
     int path_residue = strlen(path); // nieskonsumowana czesc zmiennej PATH
     int path_start = 0;              // poczatek absolutniej sciezki
     int path_end = 0;                // koniec absolutnej sciezki
@@ -134,10 +384,10 @@ noreturn void external_command(char **argv) {
       strapp(&whole_path, argv[0]);
 
       // w razie niepowodzenia ignorujemy blad
-      execve(whole_path, argv, environ);
+      execve(whole_path, argv, envp);
 
-      // zaznaczamy skonsumowana czesc PATH
-      path_residue -= path_end;
+      // zaznaczamy skonsumowana czesc PATH (wraz ze znakiem ":")
+      path_residue -= path_end + 1;
 
       // przesuwamy poczatek absolutnej sciezki na pierwszy znak po ":"
       path_start += path_end + 1;
@@ -147,9 +397,10 @@ noreturn void external_command(char **argv) {
     }
 #endif /* !STUDENT */
   } else {
-    (void)execve(argv[0], argv, environ);
+    (void)execve(argv[0], argv, envp);
   }
 
+  /* As in other shells, 127 means command not found, 126 it can't run. */
   msg("%s: %s\n", argv[0], strerror(errno));
-  exit(EXIT_FAILURE);
+  exit(errno == ENOENT ? 127 : 126);
 }
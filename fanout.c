@@ -0,0 +1,107 @@
+#include "shell.h"
+
+/* Helper process of fan-out operator `|>`. It feeds data written to pipe
+ * `input` to every pipe in `output` without copying it through user space:
+ * tee(2) duplicates pipe buffers into all outputs but the last one, and then
+ * splice(2) moves them to the last output.
+ *
+ * The first output decides how many bytes go through in each round, as the
+ * remaining ones must get exactly the same. If another output is too full to
+ * take all of them, the round is duplicated into a private pipe, where bytes
+ * already delivered are dropped, and the rest is moved from there.
+ *
+ * An output whose reader has gone is dropped, like `tee -p` does. */
+
+#define CHUNK (1 << 30)
+
+static int spare[2] = {-1, -1};
+static int devnull = -1;
+
+/* Move exactly `len` bytes from `from` to `to`. On EPIPE the remaining bytes
+ * are discarded and false is returned. */
+static bool move(int from, int to, size_t len) {
+  while (len > 0) {
+    ssize_t n = splice(from, NULL, to, NULL, len, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EPIPE && to != devnull)
+      return move(from, devnull, len), false;
+    if (n <= 0)
+      unix_error("splice error");
+    len -= n;
+  }
+  return true;
+}
+
+/* Duplicate first `len` bytes of `input` to `output`. */
+static bool duplicate(int input, int output, size_t len) {
+  ssize_t n;
+  while ((n = tee(input, output, len, 0)) < 0 && errno == EINTR)
+    continue;
+  if (n < 0 && errno == EPIPE)
+    return false;
+  if (n < 0)
+    unix_error("tee error");
+  if ((size_t)n == len)
+    return true;
+
+  if (spare[0] < 0) {
+    Pipe(spare);
+    fcntl(spare[1], F_SETPIPE_SZ, fcntl(input, F_GETPIPE_SZ));
+  }
+  /* Spare pipe is empty and as big as the input, so it takes everything. */
+  if (tee(input, spare[1], len, 0) != (ssize_t)len)
+    unix_error("tee error");
+  move(spare[0], devnull, n);
+  return move(spare[0], output, len - n);
+}
+
+noreturn void fanout(int input, int *output, int n) {
+  Signal(SIGPIPE, SIG_IGN);
+  devnull = Open("/dev/null", O_WRONLY, 0);
+
+  while (n > 0) {
+    size_t len = 0;
+
+    for (int i = 0; i < n - 1; i++) {
+      bool ok;
+      if (len == 0) {
+        ssize_t r;
+        while ((r = tee(input, output[i], CHUNK, 0)) < 0 && errno == EINTR)
+          continue;
+        if (r == 0)
+          exit(EXIT_SUCCESS);
+        if (r < 0 && errno != EPIPE)
+          unix_error("tee error");
+        if ((ok = r > 0))
+          len = r;
+      } else {
+        ok = duplicate(input, output[i], len);
+      }
+      if (!ok) {
+        Close(output[i]);
+        output[i--] = output[--n];
+      }
+    }
+
+    /* Last output consumes the data, unless it's the only one. */
+    if (len == 0) {
+      ssize_t r;
+      while ((r = splice(input, NULL, output[n - 1], NULL, CHUNK,
+                         SPLICE_F_MOVE)) < 0 &&
+             errno == EINTR)
+        continue;
+      if (r == 0)
+        exit(EXIT_SUCCESS);
+      if (r < 0 && errno != EPIPE)
+        unix_error("splice error");
+      if (r < 0)
+        Close(output[--n]);
+    } else if (!move(input, output[n - 1], len)) {
+      Close(output[--n]);
+    }
+  }
+
+  /* Nobody reads anymore, so the producer gets EPIPE once we're gone. */
+  exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,90 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "fdmove.h"
+
+/* Moves are ordered so that a descriptor is overwritten only after all moves
+ * that read it are done. Each move then costs a single dup2, which is as few
+ * system calls as it gets. If what's left are only cycles (e.g. swapping
+ * standard output and error), a source of one of them is first copied to a
+ * spare descriptor above all those in the table. That costs one extra call
+ * per cycle. Closing is left to the end, since closed descriptors may still
+ * be read by other moves. A source that is close-on-exec needs no closing. */
+
+static bool read_by(int fd, const int *src, const bool *done, int n) {
+  for (int i = 0; i < n; i++)
+    if (!done[i] && src[i] == fd)
+      return true;
+  return false;
+}
+
+int fdmove_plan(const fdmove_t *move, int n, fdop_t *op) {
+  int src[n + 1];
+  bool done[n + 1];
+  int nop = 0, top = 0;
+
+  for (int i = 0; i < n; i++) {
+    src[i] = move[i].src;
+    done[i] = src[i] < 0 || src[i] == move[i].dst;
+    if (src[i] == move[i].dst && move[i].cloexec)
+      op[nop++] = (fdop_t){FD_KEEP, -1, move[i].dst};
+    if (move[i].dst > top)
+      top = move[i].dst;
+    if (src[i] > top)
+      top = src[i];
+  }
+
+  for (;;) {
+    int pending = -1, ready = -1;
+    for (int i = 0; i < n && ready < 0; i++) {
+      if (done[i])
+        continue;
+      pending = i;
+      if (!read_by(move[i].dst, src, done, n))
+        ready = i;
+    }
+
+    if (ready >= 0) {
+      op[nop++] = (fdop_t){FD_DUP2, src[ready], move[ready].dst};
+      done[ready] = true;
+    } else if (pending >= 0) {
+      int fd = src[pending];
+      op[nop++] = (fdop_t){FD_SAVE, fd, top + 1};
+      for (int i = 0; i < n; i++)
+        if (!done[i] && src[i] == fd)
+          src[i] = FD_SPARE;
+    } else {
+      break;
+    }
+  }
+
+  for (int i = 0; i < n; i++)
+    if (move[i].src < 0)
+      op[nop++] = (fdop_t){FD_CLOSE, -1, move[i].dst};
+
+  return nop;
+}
+
+int fdmove_apply(const fdop_t *op, int n) {
+  int spare = -1;
+
+  for (int i = 0; i < n; i++) {
+    int src = op[i].src == FD_SPARE ? spare : op[i].src;
+    int rc = 0;
+    if (op[i].kind == FD_DUP2)
+      rc = dup2(src, op[i].dst);
+    else if (op[i].kind == FD_SAVE)
+      rc = spare = fcntl(src, F_DUPFD_CLOEXEC, op[i].dst);
+    else if (op[i].kind == FD_CLOSE)
+      close(op[i].dst);
+    else if (op[i].kind == FD_KEEP)
+      rc = fcntl(op[i].dst, F_SETFD, 0);
+    if (rc < 0)
+      return -1;
+  }
+
+  /* The shell applies moves to itself too, so the copy must not stay. */
+  if (spare >= 0)
+    close(spare);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef _FDMOVE_H_
+#define _FDMOVE_H_
+
+#include <stdbool.h>
+
+/* Descriptors of a new process are described by a table of moves: `dst`
+ * becomes a copy of `src`, or gets closed if `src` is -1. All moves happen
+ * at once, so a source refers to a descriptor before any move is made.
+ * `cloexec` tells that `src` is close-on-exec, so it disappears by itself
+ * when a program is executed. Descriptors not in the table stay intact. */
+typedef struct fdmove {
+  int dst;
+  int src;
+  bool cloexec;
+} fdmove_t;
+
+enum {
+  FD_DUP2,  /* make `dst` a copy of `src` */
+  FD_SAVE,  /* copy `src` to the spare descriptor, at least `dst` */
+  FD_CLOSE, /* close `dst` */
+  FD_KEEP,  /* clear close-on-exec flag of `dst` */
+};
+
+#define FD_SPARE (-2) /* `src` that refers to the spare descriptor */
+
+typedef struct fdop {
+  int kind;
+  int src;
+  int dst;
+} fdop_t;
+
+/* Operations carrying out `n` moves are stored in `op`, which has room for
+ * at least 2 * `n` of them. Returns their number. */
+int fdmove_plan(const fdmove_t *move, int n, fdop_t *op);
+/* Returns 0 on success, or -1 with errno set if an operation failed. */
+int fdmove_apply(const fdop_t *op, int n);
+
+#endif /* !_FDMOVE_H_ */
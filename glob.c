@@ -0,0 +1,416 @@
+#include "shell.h"
+
+#include <dirent.h>
+
+/* Pathname expansion. A pattern is split into components at slashes and each
+ * component is compiled into a sequence of matching operations. Directories
+ * are read with getdents64 into a large buffer and names are matched right
+ * there, so no entry is ever stat'ed unless file type reported by the kernel
+ * is unknown. Components without wildcards are not read at all, just appended
+ * to the path. `**` stands for any number of nested directories. */
+
+typedef enum { M_END, M_CHAR, M_ANY, M_STAR, M_CLASS } mkind_t;
+
+typedef struct mop {
+  mkind_t kind;
+  char ch;         /* for M_CHAR */
+  bool negate;     /* for M_CLASS */
+  uint8_t set[32]; /* for M_CLASS, bitmap of characters */
+} mop_t;
+
+typedef struct segment {
+  char *text;      /* component as written in the pattern */
+  bool literal;    /* no wildcards in the component */
+  bool recursive;  /* component is `**` */
+  mop_t *op;       /* compiled matcher terminated with M_END */
+  size_t minlen;   /* shortest name that can match */
+  const char *tail; /* literal suffix after the last star, or NULL */
+  size_t taillen;
+} segment_t;
+
+typedef struct pattern {
+  segment_t *seg;
+  int nseg;
+  bool absolute; /* pattern starts with slash */
+  bool dironly;  /* pattern ends with slash */
+} pattern_t;
+
+/* Matched paths are kept in a single pool, with offsets of their beginnings. */
+typedef struct matches {
+  char *pool;
+  size_t size, cap;
+  size_t *off;
+  int n, ncap;
+} matches_t;
+
+#define DENTBUFSZ (1 << 20)
+
+static char *dentbuf = NULL; /* buffer for getdents64 */
+
+/* Does `word` contain wildcards? Unmatched `[` is an ordinary character. */
+bool wildcard_p(const char *word) {
+  for (const char *s = word; *s; s++) {
+    if (*s == '*' || *s == '?')
+      return true;
+    if (*s == '[' && strchr(s + 1, ']'))
+      return true;
+  }
+  return false;
+}
+
+/* Parse bracket expression starting at `p` (just past `[`) into `op`.
+ * Returns pointer past closing `]` or NULL if the bracket is not closed. */
+static const char *compile_class(const char *p, const char *end, mop_t *op) {
+  op->kind = M_CLASS;
+  if (p < end && (*p == '!' || *p == '^'))
+    op->negate = true, p++;
+
+  /* A `]` right after the opening bracket stands for itself. */
+  for (bool first = true; p < end && (*p != ']' || first); first = false) {
+    uint8_t lo = *p++, hi = lo;
+    if (p + 1 < end && p[0] == '-' && p[1] != ']')
+      hi = p[1], p += 2;
+    for (unsigned c = lo; c <= hi; c++)
+      op->set[c / 8] |= 1 << (c % 8);
+  }
+
+  return p < end ? p + 1 : NULL;
+}
+
+static void compile(segment_t *sg, const char *text, size_t len) {
+  const char *end = text + len;
+  int n = 0;
+
+  sg->text = strndup(text, len);
+  sg->recursive = (len == 2 && text[0] == '*' && text[1] == '*');
+  sg->op = calloc(len + 1, sizeof(mop_t));
+  sg->literal = true;
+
+  for (const char *p = text, *q; p < end;) {
+    mop_t *op = &sg->op[n];
+    if (*p == '*') {
+      /* Consecutive stars are the same as one. */
+      if (n == 0 || sg->op[n - 1].kind != M_STAR)
+        op->kind = M_STAR, n++;
+      sg->literal = false;
+      p++;
+    } else if (*p == '?') {
+      op->kind = M_ANY, n++;
+      sg->literal = false;
+      sg->minlen++;
+      p++;
+    } else if (*p == '[' && (q = compile_class(p + 1, end, op))) {
+      n++;
+      sg->literal = false;
+      sg->minlen++;
+      p = q;
+    } else {
+      /* Unmatched bracket is an ordinary character. */
+      *op = (mop_t){.kind = M_CHAR, .ch = *p++};
+      n++;
+      sg->minlen++;
+    }
+  }
+  sg->op[n].kind = M_END;
+
+  /* Names with suffix other than the literal tail can be rejected by single
+   * comparison. That's the common case of `*.ext`. */
+  int k = n;
+  while (k > 0 && sg->op[k - 1].kind == M_CHAR)
+    k--;
+  if (k > 0 && k < n && sg->op[k - 1].kind == M_STAR) {
+    char *tail = malloc(n - k);
+    for (int i = k; i < n; i++)
+      tail[i - k] = sg->op[i].ch;
+    sg->tail = tail;
+    sg->taillen = n - k;
+  }
+}
+
+static pattern_t *pattern_compile(const char *pattern) {
+  pattern_t *pat = calloc(1, sizeof(pattern_t));
+  const char *s = pattern;
+
+  pat->absolute = (*s == '/');
+  pat->seg = malloc(sizeof(segment_t) * (strlen(pattern) / 2 + 1));
+
+  while (*s) {
+    while (*s == '/')
+      s++;
+    size_t len = strcspn(s, "/");
+    if (len == 0)
+      break;
+    segment_t *sg = &pat->seg[pat->nseg];
+    *sg = (segment_t){};
+    compile(sg, s, len);
+    /* Consecutive `**` components are the same as one. */
+    if (sg->recursive && pat->nseg > 0 && pat->seg[pat->nseg - 1].recursive) {
+      free(sg->text);
+      free(sg->op);
+    } else {
+      pat->nseg++;
+    }
+    s += len;
+  }
+
+  /* Trailing `**` matches just like `*`. */
+  if (pat->nseg > 0)
+    pat->seg[pat->nseg - 1].recursive = false;
+
+  pat->dironly = (s > pattern && s[-1] == '/');
+  return pat;
+}
+
+static void pattern_free(pattern_t *pat) {
+  for (int i = 0; i < pat->nseg; i++) {
+    free(pat->seg[i].text);
+    free(pat->seg[i].op);
+    free((char *)pat->seg[i].tail);
+  }
+  free(pat->seg);
+  free(pat);
+}
+
+static bool inclass(const mop_t *op, uint8_t c) {
+  return ((op->set[c / 8] >> (c % 8)) & 1) != op->negate;
+}
+
+/* Match `name` of length `len` against component. When the star fails to
+ * match, we restart just after it, consuming one more character. Earlier
+ * stars never need to be revisited, so that's O(len * ops) at worst. */
+static bool match(const segment_t *sg, const char *name, size_t len) {
+  /* Wildcards never match leading dot, nor `.` and `..` entries. */
+  if (name[0] == '.' && (sg->op[0].kind != M_CHAR || name[1] == '\0' ||
+                         (name[1] == '.' && name[2] == '\0')))
+    return false;
+  if (len < sg->minlen)
+    return false;
+  if (sg->tail && memcmp(name + len - sg->taillen, sg->tail, sg->taillen))
+    return false;
+
+  const mop_t *p = sg->op, *star = NULL;
+  const char *s = name, *back = NULL;
+
+  for (;;) {
+    switch (p->kind) {
+      case M_END:
+        if (*s == '\0')
+          return true;
+        break;
+      case M_STAR:
+        star = ++p, back = s;
+        continue;
+      case M_ANY:
+        if (*s) {
+          p++, s++;
+          continue;
+        }
+        break;
+      case M_CHAR:
+        if (*s == p->ch) {
+          p++, s++;
+          continue;
+        }
+        break;
+      case M_CLASS:
+        if (*s && inclass(p, *s)) {
+          p++, s++;
+          continue;
+        }
+        break;
+    }
+    if (star == NULL || *back == '\0')
+      return false;
+    p = star, s = ++back;
+  }
+}
+
+static void addmatch(matches_t *m, const char *path, size_t len) {
+  while (m->size + len + 1 > m->cap) {
+    m->cap = m->cap ? m->cap * 2 : 4096;
+    m->pool = realloc(m->pool, m->cap);
+  }
+  if (m->n == m->ncap) {
+    m->ncap = m->ncap ? m->ncap * 2 : 64;
+    m->off = realloc(m->off, sizeof(size_t) * m->ncap);
+  }
+  m->off[m->n++] = m->size;
+  memcpy(m->pool + m->size, path, len);
+  m->pool[m->size + len] = '\0';
+  m->size += len + 1;
+}
+
+/* Does path name an existing file (or directory if `dir` is set)? */
+static bool exists(const char *path, bool dir) {
+  struct stat sb;
+  if (dir)
+    return stat(path, &sb) == 0 && S_ISDIR(sb.st_mode);
+  return lstat(path, &sb) == 0;
+}
+
+static void walk(pattern_t *pat, int i, char *path, size_t len,
+                 matches_t *m);
+
+/* Extend `path` with name and a slash, then continue with component `i`. */
+static void descend(pattern_t *pat, int i, char *path, size_t len,
+                    const char *name, matches_t *m) {
+  size_t nlen = strlen(name);
+  if (len + nlen + 2 > PATH_MAX)
+    return;
+  memcpy(path + len, name, nlen);
+  path[len + nlen] = '/';
+  path[len + nlen + 1] = '\0';
+  walk(pat, i, path, len + nlen + 1, m);
+  path[len] = '\0';
+}
+
+/* Names collected from single directory, so that the directory buffer can be
+ * reused when walking into subdirectories. */
+typedef struct names {
+  char *pool;
+  size_t size, cap;
+} names_t;
+
+static void addname(names_t *nm, const char *name) {
+  size_t len = strlen(name) + 1;
+  while (nm->size + len > nm->cap) {
+    nm->cap = nm->cap ? nm->cap * 2 : 4096;
+    nm->pool = realloc(nm->pool, nm->cap);
+  }
+  memcpy(nm->pool + nm->size, name, len);
+  nm->size += len;
+}
+
+/* Find names matching component `i` in directory at `path` (which is either
+ * empty or ends with slash). */
+static void walk(pattern_t *pat, int i, char *path, size_t len,
+                 matches_t *m) {
+  if (i == pat->nseg) {
+    /* Pattern ends with slash, so only directories match. */
+    if (pat->dironly && !exists(path, true))
+      return;
+    addmatch(m, path, len);
+    return;
+  }
+
+  segment_t *sg = &pat->seg[i];
+  bool last = (i == pat->nseg - 1);
+
+  if (sg->literal) {
+    if (last) {
+      /* Final component is just checked for existence. */
+      size_t nlen = strlen(sg->text);
+      if (len + nlen + 1 > PATH_MAX)
+        return;
+      memcpy(path + len, sg->text, nlen + 1);
+      if (exists(path, pat->dironly))
+        addmatch(m, path, len + nlen);
+      path[len] = '\0';
+    } else {
+      descend(pat, i + 1, path, len, sg->text, m);
+    }
+    return;
+  }
+
+  /* `**` matches no directories at all too. */
+  if (sg->recursive)
+    walk(pat, i + 1, path, len, m);
+
+  int fd = open(len ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (dentbuf == NULL)
+    dentbuf = malloc(DENTBUFSZ);
+
+  names_t subdirs = {};
+  int nmatches = m->n;
+  size_t size = m->size;
+  long n;
+
+  struct linux_dirent64 *dents = (struct linux_dirent64 *)dentbuf;
+  while ((n = getdents64(fd, dents, DENTBUFSZ)) > 0) {
+    for (int off = 0; off < n;) {
+      struct linux_dirent64 *ent = (struct linux_dirent64 *)(dentbuf + off);
+      const char *name = ent->d_name;
+      off += ent->d_reclen;
+
+      if (sg->recursive) {
+        /* Don't follow symbolic links, nor walk into hidden directories. */
+        if (name[0] == '.')
+          continue;
+        if (ent->d_type == DT_UNKNOWN) {
+          struct stat sb;
+          if (fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) < 0 ||
+              !S_ISDIR(sb.st_mode))
+            continue;
+        } else if (ent->d_type != DT_DIR) {
+          continue;
+        }
+        addname(&subdirs, name);
+        continue;
+      }
+
+      size_t nlen = strlen(name);
+      if (!match(sg, name, nlen))
+        continue;
+
+      if (last && !pat->dironly) {
+        if (len + nlen + 1 <= PATH_MAX) {
+          memcpy(path + len, name, nlen + 1);
+          addmatch(m, path, len + nlen);
+          path[len] = '\0';
+        }
+      } else if (ent->d_type == DT_DIR || ent->d_type == DT_LNK ||
+                 ent->d_type == DT_UNKNOWN) {
+        /* Opening the directory later tells if link points to a directory. */
+        addname(&subdirs, name);
+      }
+    }
+  }
+  close(fd);
+
+  /* A directory that can't be read is skipped, as if it were empty. */
+  if (n < 0) {
+    m->n = nmatches;
+    m->size = size;
+    subdirs.size = 0;
+  }
+
+  for (size_t k = 0; k < subdirs.size; k += strlen(subdirs.pool + k) + 1)
+    descend(pat, sg->recursive ? i : i + 1, path, len, subdirs.pool + k, m);
+  free(subdirs.pool);
+}
+
+static int pathcmp(const void *a, const void *b) {
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Expands `pattern` into sorted array of matching paths, terminated with
+ * NULL. The array and all the strings are a single allocation. Returns NULL
+ * if nothing matched. Number of paths is stored at `countp`. */
+char **glob_expand(const char *pattern, int *countp) {
+  pattern_t *pat = pattern_compile(pattern);
+  matches_t m = {};
+  char path[PATH_MAX];
+
+  strcpy(path, pat->absolute ? "/" : "");
+  walk(pat, 0, path, strlen(path), &m);
+  pattern_free(pat);
+
+  *countp = m.n;
+  if (m.n == 0)
+    return NULL;
+
+  char **result = malloc(sizeof(char *) * (m.n + 1) + m.size);
+  char *area = (char *)&result[m.n + 1];
+  memcpy(area, m.pool, m.size);
+  for (int i = 0; i < m.n; i++)
+    result[i] = area + m.off[i];
+  result[m.n] = NULL;
+  qsort(result, m.n, sizeof(char *), pathcmp);
+
+  free(m.pool);
+  free(m.off);
+  return result;
+}
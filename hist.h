@@ -0,0 +1,62 @@
+#ifndef _HIST_H_
+#define _HIST_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Log-bucketed latency histogram shared by the shell (stats.c) and trace.so.
+ * Each bucket covers 1/8 of a power of two, hence values are recorded with at
+ * most 12.5% relative error. All updates are atomic, so a histogram can be
+ * placed in shared memory and updated from signal handlers. */
+
+#define HIST_SUBBITS 3
+#define HIST_NSUB (1 << HIST_SUBBITS)
+#define HIST_NBUCKET (64 * HIST_NSUB)
+
+typedef struct hist {
+  uint64_t count;                /* number of samples */
+  uint64_t sum;                  /* sum of all samples */
+  uint64_t max;                  /* largest sample */
+  uint64_t bucket[HIST_NBUCKET]; /* log-bucketed samples */
+} hist_t;
+
+static inline int hist_bucket(uint64_t v) {
+  if (v < HIST_NSUB)
+    return v;
+  int msb = 63 - __builtin_clzll(v);
+  int sub = (v >> (msb - HIST_SUBBITS)) & (HIST_NSUB - 1);
+  return (msb - HIST_SUBBITS + 1) * HIST_NSUB + sub;
+}
+
+/* Smallest value that falls into bucket `i`. */
+static inline uint64_t hist_bucket_value(int i) {
+  if (i < HIST_NSUB)
+    return i;
+  int msb = i / HIST_NSUB + HIST_SUBBITS - 1;
+  return (uint64_t)(HIST_NSUB + i % HIST_NSUB) << (msb - HIST_SUBBITS);
+}
+
+static inline void hist_record(hist_t *h, uint64_t v) {
+  uint64_t old = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&h->bucket[hist_bucket(v)], 1, __ATOMIC_RELAXED);
+  while (old < v && !__atomic_compare_exchange_n(&h->max, &old, v, true,
+                                                 __ATOMIC_RELAXED,
+                                                 __ATOMIC_RELAXED))
+    continue;
+}
+
+static inline uint64_t hist_percentile(hist_t *h, int pct) {
+  uint64_t rank = (h->count * pct + 99) / 100, seen = 0;
+  for (int i = 0; i < HIST_NBUCKET; i++) {
+    if ((seen += h->bucket[i]) >= rank) {
+      uint64_t v = hist_bucket_value(i);
+      return v < h->max ? v : h->max;
+    }
+  }
+  return h->max;
+}
+
+#endif /* !_HIST_H_ */
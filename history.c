@@ -0,0 +1,290 @@
+#include "shell.h"
+#include <stddef.h>
+
+/* Command history is an append-only file of variable-sized records. Each
+ * record is appended with a single O_APPEND write, so many shells can share
+ * the file. The file is mapped read-only and remapped when it grows. No file
+ * descriptor is kept open between calls. If SHELL_HISTORY isn't set, records
+ * are kept in memory using the same format.
+ *
+ * Substring search uses an inverted index from trigrams to entries. It is
+ * built lazily and extended as new records appear. */
+
+#define HIST_MAGIC 0x54534948 /* "HIST" */
+
+typedef struct hent {
+  uint32_t magic;    /* HIST_MAGIC */
+  uint32_t size;     /* size of the record, multiple of 8 */
+  int64_t time;      /* wall clock time when command was started */
+  uint64_t duration; /* in microseconds */
+  int32_t exitcode;  /* exit status as in $? */
+  char cmd[];        /* NUL-terminated command line */
+} hent_t;
+
+#define HENTSZ(len) ((offsetof(hent_t, cmd) + (len) + 1 + 7) & ~7)
+
+static const char *path = NULL; /* history file or NULL if in memory */
+static char *base = NULL;       /* mapped file or in-memory records */
+static size_t mapsize = 0;      /* bytes mapped (or written) at `base` */
+static size_t memcap = 0;       /* bytes allocated for in-memory records */
+static size_t size = 0;         /* bytes of valid records at `base` */
+
+static size_t *offs = NULL; /* offsets of all valid records */
+static int nents = 0;       /* number of valid records */
+static int entcap = 0;
+
+/* Trigram index: open-addressing hash table of posting lists. */
+typedef struct posting {
+  uint32_t key; /* trigram plus one, 0 marks empty slot */
+  uint32_t n, cap;
+  uint32_t *ent; /* entries containing the trigram, in ascending order */
+} posting_t;
+
+static posting_t *tri = NULL;
+static uint32_t trisize = 0; /* number of slots, power of two */
+static uint32_t ntri = 0;    /* number of used slots */
+static int indexed = 0;      /* entries below this one are indexed */
+
+static hent_t *entry(int i) {
+  return (hent_t *)(base + offs[i]);
+}
+
+/* Map whole history file, if it has grown since last time. */
+static void remap(void) {
+  struct stat sb;
+
+  if (stat(path, &sb) < 0 || (size_t)sb.st_size <= mapsize)
+    return;
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+  void *p = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return;
+
+  if (base)
+    Munmap(base, mapsize);
+  base = p;
+  mapsize = sb.st_size;
+}
+
+/* Is there a complete record at `off`? Its command must end in its last
+ * eight bytes and be padded with zeros, which rules out most of garbage. */
+static bool valid(size_t off) {
+  if (off + sizeof(hent_t) > mapsize)
+    return false;
+  hent_t *e = (hent_t *)(base + off);
+  if (e->magic != HIST_MAGIC || e->size < sizeof(hent_t) ||
+      e->size > mapsize - off)
+    return false;
+  size_t max = e->size - offsetof(hent_t, cmd);
+  size_t len = strnlen(e->cmd, max);
+  if (len == max || HENTSZ(len) != e->size)
+    return false;
+  for (size_t i = len + 1; i < max; i++)
+    if (e->cmd[i])
+      return false;
+  return true;
+}
+
+/* Collect records appended (by any shell) since last call. */
+static void refresh(void) {
+  if (path)
+    remap();
+
+  while (size + sizeof(hent_t) <= mapsize) {
+    /* A record may be not completely written yet, or cut short for good by
+     * a shell that crashed. In the latter case records appended later are
+     * found at the next valid header, wherever the cut was. */
+    if (!valid(size)) {
+      size_t next = size + 1;
+      while (next + sizeof(hent_t) <= mapsize && !valid(next))
+        next++;
+      if (next + sizeof(hent_t) > mapsize)
+        break;
+      size = next;
+    }
+    hent_t *e = (hent_t *)(base + size);
+    if (nents == entcap) {
+      entcap = entcap ? entcap * 2 : 1024;
+      offs = realloc(offs, sizeof(size_t) * entcap);
+    }
+    offs[nents++] = size;
+    size += e->size;
+  }
+}
+
+void history_append(const char *cmd, int64_t time, uint64_t duration,
+                    int exitcode) {
+  size_t len = strlen(cmd);
+  size_t esize = HENTSZ(len);
+  hent_t *e = calloc(1, esize);
+
+  e->magic = HIST_MAGIC;
+  e->size = esize;
+  e->time = time;
+  e->duration = duration;
+  e->exitcode = exitcode;
+  memcpy(e->cmd, cmd, len + 1);
+
+  if (path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0 || write(fd, e, esize) != (ssize_t)esize)
+      msg("history: %s: %s\n", path, strerror(errno));
+    if (fd >= 0)
+      close(fd);
+  } else {
+    while (mapsize + esize > memcap) {
+      memcap = memcap ? memcap * 2 : 65536;
+      base = realloc(base, memcap);
+    }
+    memcpy(base + mapsize, e, esize);
+    mapsize += esize;
+  }
+
+  free(e);
+  refresh();
+}
+
+static uint32_t trigram(const char *s) {
+  return ((uint8_t)s[0] << 16 | (uint8_t)s[1] << 8 | (uint8_t)s[2]) + 1;
+}
+
+static posting_t *lookup(uint32_t key) {
+  uint32_t mask = trisize - 1;
+  uint32_t i = (key * 2654435761u) & mask;
+
+  while (tri[i].key && tri[i].key != key)
+    i = (i + 1) & mask;
+  return &tri[i];
+}
+
+static void grow_index(void) {
+  posting_t *old = tri;
+  uint32_t oldsize = trisize;
+
+  trisize = trisize ? trisize * 2 : 4096;
+  tri = calloc(trisize, sizeof(posting_t));
+  for (uint32_t i = 0; i < oldsize; i++)
+    if (old[i].key)
+      *lookup(old[i].key) = old[i];
+  free(old);
+}
+
+static void index_entry(int i) {
+  const char *s = entry(i)->cmd;
+
+  for (; s[0] && s[1] && s[2]; s++) {
+    if (ntri * 2 >= trisize)
+      grow_index();
+    posting_t *p = lookup(trigram(s));
+    if (p->key == 0) {
+      p->key = trigram(s);
+      ntri++;
+    }
+    /* The same trigram may appear many times in a single command. */
+    if (p->n > 0 && p->ent[p->n - 1] == (uint32_t)i)
+      continue;
+    if (p->n == p->cap) {
+      p->cap = p->cap ? p->cap * 2 : 4;
+      p->ent = realloc(p->ent, sizeof(uint32_t) * p->cap);
+    }
+    p->ent[p->n++] = i;
+  }
+}
+
+int history_count(void) {
+  refresh();
+  return nents;
+}
+
+const char *history_command(int i) {
+  assert(i >= 0 && i < nents);
+  return entry(i)->cmd;
+}
+
+/* Returns the most recent entry before `before` that contains `pattern`,
+ * or -1 if there's none. */
+int history_find(const char *pattern, int before) {
+  refresh();
+  if (before > nents)
+    before = nents;
+
+  size_t len = strlen(pattern);
+
+  /* Too short to use the index. */
+  if (len < 3) {
+    for (int i = before - 1; i >= 0; i--)
+      if (strstr(entry(i)->cmd, pattern))
+        return i;
+    return -1;
+  }
+
+  while (indexed < nents)
+    index_entry(indexed++);
+
+  /* No entry is long enough to have a trigram. */
+  if (trisize == 0)
+    return -1;
+
+  /* Every trigram of the pattern must occur in a matching entry, so only
+   * entries on the shortest posting list need to be checked. */
+  posting_t *best = NULL;
+  for (size_t k = 0; k + 3 <= len; k++) {
+    posting_t *p = lookup(trigram(pattern + k));
+    if (p->key == 0)
+      return -1;
+    if (best == NULL || p->n < best->n)
+      best = p;
+  }
+
+  /* Posting lists are sorted, so skip entries that are not before `before`. */
+  uint32_t lo = 0, hi = best->n;
+  while (lo < hi) {
+    uint32_t mid = (lo + hi) / 2;
+    if (best->ent[mid] < (uint32_t)before)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  while (lo-- > 0)
+    if (strstr(entry(best->ent[lo])->cmd, pattern))
+      return best->ent[lo];
+  return -1;
+}
+
+/* Print entries containing `pattern` (all of them if NULL), oldest first. */
+void history_print(outbuf_t *out, const char *pattern) {
+  int n = 0, *found = NULL;
+
+  if (pattern == NULL) {
+    n = history_count();
+  } else {
+    for (int i = history_find(pattern, INT_MAX); i >= 0;
+         i = history_find(pattern, i)) {
+      found = realloc(found, sizeof(int) * (n + 1));
+      found[n++] = i;
+    }
+  }
+
+  for (int k = 0; k < n; k++) {
+    int i = found ? found[n - 1 - k] : k;
+    hent_t *e = entry(i);
+    time_t t = e->time;
+    char date[32];
+    strftime(date, sizeof(date), "%F %T", localtime(&t));
+    outbuf_printf(out, "%6d  %s %4d %10.3fs  %s\n", i + 1, date, e->exitcode,
+                  e->duration / 1e6, e->cmd);
+  }
+
+  free(found);
+}
+
+/* Called just at the beginning of shell's life. */
+void inithistory(void) {
+  path = getenv("SHELL_HISTORY");
+  refresh();
+}
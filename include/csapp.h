@@ -144,6 +144,47 @@ struct linux_dirent {
 
 int Getdents(int fd, struct linux_dirent *dirp, unsigned count);
 
+struct linux_dirent64 {
+  uint64_t d_ino;          /* Inode number */
+  int64_t d_off;           /* Offset to next linux_dirent64 */
+  unsigned short d_reclen; /* Length of this linux_dirent64 */
+  unsigned char d_type;    /* File type (DT_*) */
+  char d_name[];           /* Filename (null-terminated) */
+};
+
+int getdents64(int fd, struct linux_dirent64 *dirp, unsigned count);
+int Getdents64(int fd, struct linux_dirent64 *dirp, unsigned count);
+
+/* Anonymous memory files (Linux specific) */
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+int Memfd_create(const char *name, unsigned flags);
+
+/* Moving data between pipes (Linux specific) */
+#ifndef SPLICE_F_MOVE
+#define SPLICE_F_MOVE 1
+#endif
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#define F_GETPIPE_SZ 1032
+#endif
+
+ssize_t tee(int fdin, int fdout, size_t len, unsigned flags);
+ssize_t splice(int fdin, off_t *offin, int fdout, off_t *offout, size_t len,
+               unsigned flags);
+
 /* Directory operations */
 void Rename(const char *oldpath, const char *newpath);
 void Unlink(const char *pathname);
@@ -200,6 +241,8 @@ int open_clientfd(char *hostname, char *port);
 int Open_clientfd(char *hostname, char *port);
 int open_listenfd(char *port, int backlog);
 int Open_listenfd(char *port, int backlog);
+int open_unix_listenfd(const char *path, int backlog);
+int Open_unix_listenfd(const char *path, int backlog);
 
 /* POSIX thread control wrappers. */
 
@@ -0,0 +1,188 @@
+#include "shell.h"
+#include "rio.h"
+
+/* Job lifecycle events are put into a ring buffer by `addjob`, `addproc`,
+ * `deljob` and SIGCHLD handler. Events are formatted as JSON lines and written
+ * out in a batch just before the prompt is displayed, so logging never blocks
+ * command execution. When the ring is full new events are dropped. */
+
+#define NEVENTS 1024
+#define TEXTSZ 96
+
+typedef struct event {
+  uint64_t seq;      /* slot is ready when equal to event number plus one */
+  uint64_t time;     /* wall clock time in microseconds */
+  uint64_t duration; /* job duration in microseconds (EV_DONE only) */
+  int type;          /* one of EV_* */
+  int job;           /* job number */
+  pid_t pgid;        /* process group of the job */
+  pid_t pid;         /* process identifier (if applicable) */
+  int status;        /* status as returned by waitpid */
+  char text[TEXTSZ]; /* command or program name */
+} event_t;
+
+static event_t *ring = NULL;
+static uint64_t head = 0;    /* number of reserved slots */
+static uint64_t tail = 0;    /* number of consumed slots */
+static uint64_t dropped = 0; /* number of events lost due to full ring */
+static int logfd = -1;       /* log file descriptor */
+static pid_t owner = 0;      /* only the shell writes out the events */
+static int sample = 1;       /* log every n-th job */
+static int nsampled = 0;     /* jobs seen since last logged one */
+
+static const char *evname[] = {
+  [EV_SPAWN] = "spawn", [EV_PROC] = "proc", [EV_STOP] = "stop",
+  [EV_CONT] = "continue", [EV_EXIT] = "exit", [EV_DONE] = "done",
+};
+
+static uint64_t wallclock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Decide whether a new job should be logged. */
+bool joblog_sample(void) {
+  if (logfd < 0)
+    return false;
+  if (++nsampled < sample)
+    return false;
+  nsampled = 0;
+  return true;
+}
+
+/* Safe to call from signal handlers. */
+void joblog(int type, int job, pid_t pgid, pid_t pid, int status,
+            uint64_t duration, const char *text) {
+  uint64_t n = __atomic_load_n(&head, __ATOMIC_RELAXED);
+
+  do {
+    if (n - __atomic_load_n(&tail, __ATOMIC_ACQUIRE) >= NEVENTS) {
+      __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+      return;
+    }
+  } while (!__atomic_compare_exchange_n(&head, &n, n + 1, true,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+  event_t *ev = &ring[n % NEVENTS];
+  ev->time = wallclock();
+  ev->duration = duration;
+  ev->type = type;
+  ev->job = job;
+  ev->pgid = pgid;
+  ev->pid = pid;
+  ev->status = status;
+  ev->text[0] = '\0';
+  if (text) {
+    strncpy(ev->text, text, TEXTSZ - 1);
+    ev->text[TEXTSZ - 1] = '\0';
+  }
+  __atomic_store_n(&ev->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+/* Append string to buffer escaping characters as required by JSON. */
+static int jsonstr(char *buf, const char *s) {
+  int n = 0;
+  buf[n++] = '"';
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      buf[n++] = '\\';
+      buf[n++] = *s;
+    } else if ((unsigned char)*s < ' ') {
+      n += sprintf(buf + n, "\\u%04x", *s);
+    } else {
+      buf[n++] = *s;
+    }
+  }
+  buf[n++] = '"';
+  return n;
+}
+
+static int format(char *buf, event_t *ev) {
+  int n = sprintf(buf, "{\"time\":%lu.%06lu,\"event\":\"%s\",\"job\":%d",
+                  ev->time / 1000000, ev->time % 1000000, evname[ev->type],
+                  ev->job);
+
+  if (ev->type == EV_EXIT || ev->type == EV_DONE) {
+    if (WIFSIGNALED(ev->status))
+      n += sprintf(buf + n, ",\"signal\":%d", WTERMSIG(ev->status));
+    else
+      n += sprintf(buf + n, ",\"status\":%d", WEXITSTATUS(ev->status));
+  }
+  n += sprintf(buf + n, ",\"pgid\":%d", ev->pgid);
+  if (ev->pid)
+    n += sprintf(buf + n, ",\"pid\":%d", ev->pid);
+  if (ev->type == EV_DONE)
+    n += sprintf(buf + n, ",\"duration\":%lu.%06lu", ev->duration / 1000000,
+                 ev->duration % 1000000);
+  if (ev->text[0]) {
+    n += sprintf(buf + n, ",\"%s\":", ev->type == EV_PROC ? "argv0" : "cmd");
+    n += jsonstr(buf + n, ev->text);
+  }
+  buf[n++] = '}';
+  buf[n++] = '\n';
+  return n;
+}
+
+/* Longest possible formatted event, assuming each character of text gets
+ * escaped with \uXXXX sequence. */
+#define LINESZ (256 + TEXTSZ * 6)
+
+/* Write out all events that are ready. Called before the prompt is shown. */
+void joblog_flush(void) {
+  static char buf[RIO_BUFSIZE + LINESZ];
+  int n = 0;
+
+  if (logfd < 0 || getpid() != owner)
+    return;
+
+  for (;;) {
+    event_t *ev = &ring[tail % NEVENTS];
+    if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != tail + 1)
+      break;
+    n += format(buf + n, ev);
+    __atomic_store_n(&tail, tail + 1, __ATOMIC_RELEASE);
+    if (n >= RIO_BUFSIZE) {
+      rio_writen(logfd, buf, n);
+      n = 0;
+    }
+  }
+
+  uint64_t lost = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+  if (lost) {
+    uint64_t now = wallclock();
+    n += sprintf(buf + n, "{\"time\":%lu.%06lu,\"event\":\"dropped\",",
+                 now / 1000000, now % 1000000);
+    n += sprintf(buf + n, "\"count\":%lu}\n", lost);
+  }
+
+  if (n > 0)
+    rio_writen(logfd, buf, n);
+}
+
+/* If SHELL_JOBLOG names a file, then append job lifecycle events there.
+ * SHELL_JOBLOG_SAMPLE=n makes the shell log only every n-th job. */
+void initjoblog(void) {
+  const char *path = getenv("SHELL_JOBLOG");
+  const char *rate = getenv("SHELL_JOBLOG_SAMPLE");
+
+  if (path == NULL)
+    return;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    msg("joblog: %s: %s\n", path, strerror(errno));
+    return;
+  }
+
+  /* Keep low descriptor numbers available for the user. */
+  logfd = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+  Close(fd);
+
+  if (rate && (sample = atoi(rate)) < 1)
+    sample = 1;
+
+  ring = Calloc(NEVENTS, sizeof(event_t));
+  owner = getpid();
+  atexit(joblog_flush);
+}
@@ -4,6 +4,7 @@ typedef struct proc {
   pid_t pid;    /* process identifier */
   int state;    /* RUNNING or STOPPED or FINISHED */
   int exitcode; /* -1 if exit status not yet received */
+  bool helper;  /* started by the shell, not a part of the command */
 } proc_t;
 
 typedef struct job {
@@ -13,6 +14,9 @@ typedef struct job {
   int nproc;             /* number of processes */
   int state;             /* changes when live processes have same state */
   char *command;         /* textual representation of command line */
+  bool logged;           /* lifecycle events go to job log */
+  bool batch;            /* exit status is aggregated as by xargs */
+  uint64_t started;      /* time of job creation */
 } job_t;
 
 static job_t *jobs = NULL;          /* array of all jobs */
@@ -22,6 +26,7 @@ static struct termios shell_tmodes; /* saved shell terminal modes */
 
 static void sigchld_handler(int sig) {
   int old_errno = errno;
+  uint64_t start = stats_clock();
   pid_t pid;
   int status;
   /* TODO: Change state (FINISHED, RUNNING, STOPPED) of processes and jobs.
@@ -53,18 +58,83 @@ static void sigchld_handler(int sig) {
       } else if (WIFCONTINUED(status)) {
         jobs[j].proc[p].state = RUNNING;
       }
+
+      // zapisujemy zdarzenie w dzienniku zadan
+      if (jobs[j].logged) {
+        int event = WIFSTOPPED(status)     ? EV_STOP
+                    : WIFCONTINUED(status) ? EV_CONT
+                                           : EV_EXIT;
+        joblog(event, j, jobs[j].pgid, pid, status, 0, NULL);
+      }
     }
 
-    // zmieniamy stan zadania na podstawie ostatniego procesu w tym zadaniu
-    jobs[j].state = jobs[j].proc[jobs[j].nproc - 1].state;
+    // zadanie dziala dopoki dziala ktorykolwiek z jego procesow, a konczy sie
+    // dopiero gdy skoncza sie wszystkie - inaczej shell moglby odebrac
+    // terminal zanim wczesniejszy proces potoku wywola setfgpgrp
+    int state = FINISHED;
+    for (int p = 0; p < jobs[j].nproc; p++) {
+      if (jobs[j].proc[p].state == RUNNING)
+        state = RUNNING;
+      else if (jobs[j].proc[p].state == STOPPED && state == FINISHED)
+        state = STOPPED;
+    }
+    jobs[j].state = state;
   }
 #endif /* !STUDENT */
+  stats_record(S_REAP, start);
   errno = old_errno;
 }
 
-/* When pipeline is done, its exitcode is fetched from the last process. */
+/* Wait for SIGCHLD to be delivered, measuring time spent asleep. */
+static void suspend(sigset_t *mask) {
+  uint64_t start = stats_clock();
+  sigsuspend(mask);
+  stats_record(S_SIGSUSPEND, start);
+}
+
+/* Restore terminal attributes, measuring time spent in the call. */
+static void settmodes(struct termios *tmodes) {
+  if (tty_fd < 0)
+    return;
+  uint64_t start = stats_clock();
+  Tcsetattr(tty_fd, TCSADRAIN, tmodes);
+  stats_record(S_TCSETATTR, start);
+}
+
+/* Batch fails like xargs does: 124 if a command exited with 255, 125 if it
+ * was killed, 126 or 127 if it couldn't be run, 123 on any other failure.
+ * The highest code wins. Processes that haven't finished are skipped. */
+static int batchcode(job_t *job) {
+  int code = 0;
+
+  for (int p = 0; p < job->nproc; p++) {
+    int status = job->proc[p].exitcode, c;
+    if (status < 0)
+      continue;
+    if (WIFSIGNALED(status))
+      c = 125;
+    else if (WEXITSTATUS(status) == 255)
+      c = 124;
+    else if (WEXITSTATUS(status) >= 126)
+      c = WEXITSTATUS(status);
+    else
+      c = WEXITSTATUS(status) ? 123 : 0;
+    if (c > code)
+      code = c;
+  }
+
+  return W_EXITCODE(code, 0);
+}
+
+/* When pipeline is done, its exitcode is fetched from the last process that
+ * is not a helper. */
 static int exitcode(job_t *job) {
-  return job->proc[job->nproc - 1].exitcode;
+  if (job->batch)
+    return batchcode(job);
+  int p = job->nproc - 1;
+  while (p > 0 && job->proc[p].helper)
+    p--;
+  return job->proc[p].exitcode;
 }
 
 static int allocjob(void) {
@@ -95,11 +165,18 @@ int addjob(pid_t pgid, int bg) {
   job->proc = NULL;
   job->nproc = 0;
   job->tmodes = shell_tmodes;
+  job->batch = false;
+  job->started = stats_clock();
+  if ((job->logged = joblog_sample()))
+    joblog(EV_SPAWN, j, pgid, 0, 0, 0, NULL);
   return j;
 }
 
 static void deljob(job_t *job) {
   assert(job->state == FINISHED);
+  if (job->logged)
+    joblog(EV_DONE, job - jobs, job->pgid, 0, exitcode(job),
+           (stats_clock() - job->started) / 1000, job->command);
   free(job->command);
   free(job->proc);
   job->pgid = 0;
@@ -108,33 +185,90 @@ static void deljob(job_t *job) {
   job->nproc = 0;
 }
 
+/* Deletes job `j` as if all of its processes have finished. Used by
+ * microbench, whose jobs have no real processes. */
+void dropjob(int j) {
+  jobs[j].state = FINISHED;
+  deljob(&jobs[j]);
+}
+
 static void movejob(int from, int to) {
   assert(jobs[to].pgid == 0);
   memcpy(&jobs[to], &jobs[from], sizeof(job_t));
   memset(&jobs[from], 0, sizeof(job_t));
 }
 
+/* Command text is built with a single allocation, since expanded wildcards
+ * may make argument list really long. */
 static void mkcommand(char **cmdp, char **argv) {
-  if (*cmdp)
-    strapp(cmdp, " | ");
+  size_t len = *cmdp ? strlen(*cmdp) + 3 : 0;
+  size_t size = len;
 
-  for (strapp(cmdp, *argv++); *argv; argv++) {
-    strapp(cmdp, " ");
-    strapp(cmdp, *argv);
+  for (char **arg = argv; *arg; arg++)
+    size += strlen(*arg) + 1;
+
+  char *cmd = realloc(*cmdp, size);
+  if (len)
+    memcpy(cmd + len - 3, " | ", 3);
+
+  for (; *argv; argv++) {
+    size_t n = strlen(*argv);
+    memcpy(cmd + len, *argv, n);
+    cmd[len + n] = ' ';
+    len += n + 1;
   }
+  cmd[len - 1] = '\0';
+  *cmdp = cmd;
 }
 
 void addproc(int j, pid_t pid, char **argv) {
   assert(j < njobmax);
   job_t *job = &jobs[j];
 
+  /* A process started when all others have finished leads a new group. */
+  if (job->state == FINISHED)
+    job->pgid = pid;
+  job->state = RUNNING;
+
   int p = allocproc(j);
   proc_t *proc = &job->proc[p];
   /* Initial state of a process. */
   proc->pid = pid;
   proc->state = RUNNING;
   proc->exitcode = -1;
-  mkcommand(&job->command, argv);
+  proc->helper = argv == NULL;
+  /* Processes of a batch run the same command. Helpers started by the shell
+   * itself (with no `argv`) are not a part of it. */
+  if (argv && (p == 0 || !job->batch))
+    mkcommand(&job->command, argv);
+  if (job->logged)
+    joblog(EV_PROC, j, job->pgid, pid, 0, 0, argv ? argv[0] : NULL);
+}
+
+/* Make job `j` a batch, i.e. a job whose processes are started one by one,
+ * each with a chunk of a long argument list. */
+void batchjob(int j) {
+  jobs[j].batch = true;
+}
+
+/* Wait till fewer than `n` processes of batch `j` are running. Returns the
+ * process group next process should join, 0 if it should lead a new group,
+ * or -1 if the batch must not go on: it was stopped, or a process failed in
+ * a way that makes xargs give up. */
+pid_t batchwait(int j, int n, sigset_t *mask) {
+  job_t *job = &jobs[j];
+
+  for (;;) {
+    int running = 0;
+    for (int p = 0; p < job->nproc; p++)
+      if (job->proc[p].state == RUNNING)
+        running++;
+    if (job->state == STOPPED || WEXITSTATUS(batchcode(job)) >= 124)
+      return -1;
+    if (running < n)
+      return job->state == FINISHED ? 0 : job->pgid;
+    suspend(mask);
+  }
 }
 
 /* Returns job's state.
@@ -163,6 +297,28 @@ char *jobcmd(int j) {
   return job->command;
 }
 
+/* Stores pids of processes of job `j` that haven't finished yet in `pids`,
+ * which has room for `max` of them, and job's state in `statep`. Returns the
+ * number of pids stored, or -1 if the slot is free. */
+int jobprocs(int j, pid_t *pids, int max, int *statep) {
+  assert(j < njobmax);
+  job_t *job = &jobs[j];
+  if (job->pgid == 0)
+    return -1;
+
+  int n = 0;
+  for (int i = 0; i < job->nproc && n < max; i++)
+    if (job->proc[i].state != FINISHED)
+      pids[n++] = job->proc[i].pid;
+  *statep = job->state;
+  return n;
+}
+
+/* Number of slots in the job table. */
+int jobslots(void) {
+  return njobmax;
+}
+
 /* Continues a job that has been stopped. If move to foreground was requested,
  * then move the job to foreground and start monitoring it. */
 bool resumejob(int j, int bg, sigset_t *mask) {
@@ -183,7 +339,7 @@ bool resumejob(int j, int bg, sigset_t *mask) {
     setfgpgrp(jobs[j].pgid);
 
     // przywracamy zmienne srodowiskowe termianala odpowiadajace zadaniu
-    Tcsetattr(tty_fd, TCSADRAIN, &jobs[j].tmodes);
+    settmodes(&jobs[j].tmodes);
 
     // przenosimy zadanie na miejsce zadania pierwszoplanowego
     movejob(j, FG);
@@ -193,7 +349,7 @@ bool resumejob(int j, int bg, sigset_t *mask) {
 
     // czekamy na zmiane stanu zadania zapobiegajac wyscigu
     while (jobs[FG].state != RUNNING) {
-      sigsuspend(mask);
+      suspend(mask);
     }
     // monitorujemy zadanie
     monitorjob(mask);
@@ -277,7 +433,7 @@ int monitorjob(sigset_t *mask) {
 #ifdef STUDENT
   // czekamy na zmiane stany zadania
   while ((state = jobstate(FG, &exitcode)) == RUNNING) {
-    sigsuspend(mask);
+    suspend(mask);
   }
 
   // jezeli zostalo zatrzymane szukamy nowego meijsca dla zadania i zwalniamy
@@ -288,18 +444,25 @@ int monitorjob(sigset_t *mask) {
     msg("[%d] stopped %s\n", job_idx, jobcmd(job_idx));
   }
 
+  // zwracamy kod wyjscia w postaci znanej z $? (128 + numer sygnalu jezeli
+  // zadanie zostalo zabite)
+  if (state == FINISHED)
+    exitcode = WIFSIGNALED(exitcode) ? 128 + WTERMSIG(exitcode)
+                                     : WEXITSTATUS(exitcode);
+
   // oddajemy kontrole nad tetrminalem z powrotem do shell-a
   setfgpgrp(getpgid(0));
 
   // przywracamy zmienne srodowiskowe terminala odpowiadajace shell-owi
-  Tcsetattr(tty_fd, TCSADRAIN, &shell_tmodes);
+  settmodes(&shell_tmodes);
 #endif /* !STUDENT */
 
   return exitcode;
 }
 
-/* Called just at the beginning of shell's life. */
-void initjobs(void) {
+/* Called just at the beginning of shell's life. A shell that is not
+ * interactive leaves the terminal alone. */
+void initjobs(bool interactive) {
   struct sigaction act = {
     .sa_flags = SA_RESTART,
     .sa_handler = sigchld_handler,
@@ -313,6 +476,9 @@ void initjobs(void) {
 
   jobs = calloc(sizeof(job_t), 1);
 
+  if (!interactive)
+    return;
+
   /* Assume we're running in interactive mode, so move us to foreground.
    * Duplicate terminal fd, but do not leak it to subprocesses that execve. */
   assert(isatty(STDIN_FILENO));
@@ -339,7 +505,7 @@ void shutdownjobs(void) {
     killjob(j);
     // czekamy na zmiane stanu zadania
     while (jobs[j].state != FINISHED) {
-      sigsuspend(&mask);
+      suspend(&mask);
     }
   }
 #endif /* !STUDENT */
@@ -348,10 +514,36 @@ void shutdownjobs(void) {
 
   Sigprocmask(SIG_SETMASK, &mask, NULL);
 
+  if (tty_fd >= 0)
+    Close(tty_fd);
+}
+
+/* Called by a subshell, since jobs it inherited belong to its parent. */
+void forgetjobs(void) {
+  for (int j = 0; j < njobmax; j++) {
+    free(jobs[j].command);
+    free(jobs[j].proc);
+  }
+  memset(jobs, 0, sizeof(job_t) * njobmax);
+}
+
+/* Moves the terminal descriptor out of the way if it's `fd`, which the user
+ * wants to open with "exec". */
+void releasefd(int fd) {
+  if (fd != tty_fd)
+    return;
+  int newfd = fcntl(tty_fd, F_DUPFD_CLOEXEC, 10);
+  if (newfd < 0)
+    unix_error("fcntl error");
   Close(tty_fd);
+  tty_fd = newfd;
 }
 
 /* Sets foreground process group to `pgid`. */
 void setfgpgrp(pid_t pgid) {
+  if (tty_fd < 0)
+    return;
+  uint64_t start = stats_clock();
   Tcsetpgrp(tty_fd, pgid);
+  stats_record(S_SETFGPGRP, start);
 }
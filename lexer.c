@@ -12,6 +12,217 @@ void strapp(char **dstp, const char *src) {
   }
 }
 
+/* Process substitution is left intact, as its command is evaluated by the
+ * process that runs it. */
+bool procsubst_p(const char *word) {
+  return (word[0] == '<' || word[0] == '>') && substlen(word) == strlen(word);
+}
+
+/* Replace each word for which `match` holds with words returned by `expand`
+ * (an array terminated with NULL, allocated as a single block), or leave the
+ * word intact if `expand` returns NULL. As words may refer to the area after
+ * the token array, everything is copied into a new block, which the caller
+ * frees just like the old one. */
+static token_t *replacewords(token_t *tokvec, int *tokc_p,
+                             bool (*match)(const char *),
+                             char **(*expand)(const char *, int *)) {
+  int ntoks = *tokc_p;
+  int nmatch = 0;
+
+  for (int i = 0; i < ntoks; i++)
+    if (string_p(tokvec[i]) && match(tokvec[i]))
+      nmatch++;
+
+  if (nmatch == 0)
+    return tokvec;
+
+  char ***words = calloc(ntoks, sizeof(char **));
+  size_t size = 0;
+  int n = 0;
+
+  for (int i = 0; i < ntoks; i++) {
+    int count = 0;
+    if (string_p(tokvec[i]) && match(tokvec[i]))
+      words[i] = expand(tokvec[i], &count);
+    if (words[i] == NULL) {
+      if (string_p(tokvec[i]))
+        size += strlen(tokvec[i]) + 1;
+      n++;
+      continue;
+    }
+    for (int k = 0; k < count; k++)
+      size += strlen(words[i][k]) + 1;
+    n += count;
+  }
+
+  token_t *result = malloc(sizeof(token_t) * (n + 1) + size);
+  char *area = (char *)&result[n + 1];
+  int j = 0;
+
+  for (int i = 0; i < ntoks; i++) {
+    token_t *ws = words[i] ? words[i] : (token_t[]){tokvec[i], NULL};
+    for (token_t *w = ws; *w; w++) {
+      if (!string_p(*w)) {
+        result[j++] = *w;
+        continue;
+      }
+      size_t len = strlen(*w) + 1;
+      result[j++] = memcpy(area, *w, len);
+      area += len;
+    }
+    free(words[i]);
+  }
+  result[j] = NULL;
+
+  free(words);
+  free(tokvec);
+  *tokc_p = n;
+  return result;
+}
+
+/* Length of command substitution "$(...)" or process substitution "<(...)"
+ * or ">(...)" at the beginning of `s`, or 0 if there's none or its
+ * parentheses are not balanced. */
+size_t substlen(const char *s) {
+  if ((s[0] != '$' && s[0] != '<' && s[0] != '>') || s[1] != '(')
+    return 0;
+
+  int depth = 0;
+  for (const char *p = s + 1; *p; p++) {
+    if (*p == '(')
+      depth++;
+    else if (*p == ')' && --depth == 0)
+      return p - s + 1;
+  }
+  return 0;
+}
+
+static bool subst_p(const char *word) {
+  if (procsubst_p(word))
+    return false;
+  for (const char *s = strstr(word, "$("); s; s = strstr(s + 1, "$("))
+    if (substlen(s))
+      return true;
+  return false;
+}
+
+/* Evaluate command substitutions found in `word`, expand variables in text
+ * between them, and split the result into words at whitespace. */
+static char **substwords(const char *word, int *countp) {
+  char *text = NULL;
+  size_t len = 0;
+
+  while (*word) {
+    const char *next = strstr(word, "$(");
+    size_t n = next ? (size_t)(next - word) : strlen(word);
+    char *output = NULL;
+
+    /* Unbalanced "$(" is left as it is. */
+    if (n == 0 && (n = substlen(word))) {
+      char *cmd = strndup(word + 2, n - 3);
+      output = cmdsubst(cmd);
+      free(cmd);
+    } else if (n == 0) {
+      n = 2;
+    }
+
+    if (output == NULL) {
+      char *piece = strndup(word, n);
+      output = malloc(expand(NULL, piece) + 1);
+      expand(output, piece);
+      free(piece);
+    }
+
+    size_t plen = strlen(output);
+    text = realloc(text, len + plen + 1);
+    memcpy(text + len, output, plen);
+    len += plen;
+    text[len] = '\0';
+    word += n;
+    free(output);
+  }
+
+  int count = 0;
+  for (char *s = text; *s;) {
+    while (isspace(*s))
+      s++;
+    if (*s == '\0')
+      break;
+    count++;
+    while (*s && !isspace(*s))
+      s++;
+  }
+
+  char **result = malloc(sizeof(char *) * (count + 1) + len + 1);
+  char *area = memcpy(&result[count + 1], text, len + 1);
+  int k = 0;
+  for (char *s = area; *s;) {
+    if (isspace(*s)) {
+      *s++ = '\0';
+      continue;
+    }
+    result[k++] = s;
+    while (*s && !isspace(*s))
+      s++;
+  }
+  result[k] = NULL;
+
+  free(text);
+  *countp = count;
+  return result;
+}
+
+static bool expandable_p(const char *word) {
+  return strchr(word, '$') && !procsubst_p(word);
+}
+
+/* Variable references and command substitutions are expanded in a single
+ * pass over the word as it was typed, so that text coming from a variable is
+ * never evaluated as a command. Variables alone don't split the word, and a
+ * word expanding to empty string is removed. */
+static char **expandword(const char *word, int *countp) {
+  if (subst_p(word))
+    return substwords(word, countp);
+
+  size_t len = expand(NULL, word);
+  char **result = malloc(sizeof(char *) * 2 + len + 1);
+  result[0] = expand((char *)&result[2], word) ? (char *)&result[2] : NULL;
+  result[1] = NULL;
+  *countp = len ? 1 : 0;
+  return result;
+}
+
+/* Can the word of length `len` be a descriptor number? */
+static bool fdword_p(const char *s, size_t len) {
+  const char *name = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ_"
+                     "abcdefghijklmnopqrstuvwxyz";
+  if (strspn(s, "0123456789") == len)
+    return true;
+  return len > 1 && s[0] == '$' && strspn(s + 1, name) == len - 1;
+}
+
+static bool glob_p(const char *word) {
+  return !procsubst_p(word) && wildcard_p(word);
+}
+
+/* Length of a word starting at `s`. Command substitution may contain
+ * characters that otherwise end a word, so it's skipped as a whole. Process
+ * substitution makes a word of its own. */
+static size_t wordlen(const char *s) {
+  size_t n = 0;
+
+  if (s[0] == '<' || s[0] == '>')
+    return substlen(s);
+
+  for (;;) {
+    n += strcspn(s + n, " |&<>;!$");
+    if (s[n] != '$')
+      return n;
+    size_t l = substlen(s + n);
+    n += l ? l : 1;
+  }
+}
+
 token_t *tokenize(char *s, int *tokc_p) {
   int capacity = 10;
   int ntoks = 0;
@@ -25,14 +236,19 @@ token_t *tokenize(char *s, int *tokc_p) {
       continue;
     }
 
-    /* Make sure there's enough space to add new token. */
-    if (ntoks == capacity) {
+    /* Make sure there's enough space to add two new tokens. */
+    if (ntoks + 1 >= capacity) {
       capacity *= 2;
       tokvec = realloc(tokvec, sizeof(token_t) * (capacity + 1));
     }
 
-    size_t l = strcspn(s, " |&<>;!");
+    size_t l = wordlen(s);
     if (l > 0) {
+      /* Digits right before a redirection operator make a descriptor number,
+       * e.g. "2>&1". They're terminated when the operator is consumed. So does
+       * a variable, e.g. "$fd>&-", which do_redir checks after expansion. */
+      if (fdword_p(s, l) && (s[l] == '<' || s[l] == '>') && s[l + 1] != '(')
+        tokvec[ntoks++] = T_IONUM;
       tokvec[ntoks++] = s;
       s += l;
       continue;
@@ -44,6 +260,9 @@ token_t *tokenize(char *s, int *tokc_p) {
       if (s[1] == '|') {
         *s++ = 0;
         tok = T_OR;
+      } else if (s[1] == '>') {
+        *s++ = 0;
+        tok = T_FANOUT;
       } else {
         tok = T_PIPE;
       }
@@ -55,9 +274,32 @@ token_t *tokenize(char *s, int *tokc_p) {
         tok = T_BGJOB;
       }
     } else if (s[0] == '<') {
-      tok = T_INPUT;
+      if (s[1] == '<' && s[2] == '<') {
+        *s++ = 0;
+        *s++ = 0;
+        tok = T_HERESTR;
+      } else if (s[1] == '<') {
+        *s++ = 0;
+        tok = T_HEREDOC;
+      } else if (s[1] == '&') {
+        *s++ = 0;
+        tok = T_DUPIN;
+      } else if (s[1] == '>') {
+        *s++ = 0;
+        tok = T_RDWR;
+      } else {
+        tok = T_INPUT;
+      }
     } else if (s[0] == '>') {
-      tok = T_OUTPUT;
+      if (s[1] == '>') {
+        *s++ = 0;
+        tok = T_APPEND;
+      } else if (s[1] == '&') {
+        *s++ = 0;
+        tok = T_DUPOUT;
+      } else {
+        tok = T_OUTPUT;
+      }
     } else if (s[0] == ';') {
       tok = T_COLON;
     } else if (s[0] == '!') {
@@ -72,5 +314,6 @@ token_t *tokenize(char *s, int *tokc_p) {
 
   tokvec[ntoks] = NULL;
   *tokc_p = ntoks;
-  return tokvec;
+  tokvec = replacewords(tokvec, tokc_p, expandable_p, expandword);
+  return replacewords(tokvec, tokc_p, glob_p, glob_expand);
 }
@@ -0,0 +1,21 @@
+#include "csapp.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+
+/*
+ * getdents64 - Read directory entries, as glibc declares only with
+ *     _GNU_SOURCE. On error, returns -1 with errno set.
+ */
+
+int getdents64(int fd, struct linux_dirent64 *dirp, unsigned count) {
+  return syscall(__NR_getdents64, fd, dirp, count);
+}
+
+int Getdents64(int fd, struct linux_dirent64 *dirp, unsigned count) {
+  int rc = getdents64(fd, dirp, count);
+  if (rc < 0)
+    unix_error("Getdents64 error");
+  return rc;
+}
+#endif
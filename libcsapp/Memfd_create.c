@@ -0,0 +1,12 @@
+#include "csapp.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+
+int Memfd_create(const char *name, unsigned flags) {
+  int rc = syscall(__NR_memfd_create, name, flags);
+  if (rc < 0)
+    unix_error("Memfd_create error");
+  return rc;
+}
+#endif
@@ -0,0 +1,46 @@
+#include "csapp.h"
+#include <sys/un.h>
+
+/*
+ * open_unix_listenfd - Open and return a listening UNIX-domain socket bound
+ *     to path. A socket file left behind by a previous server is removed.
+ *     The descriptor is close-on-exec.
+ *
+ *     On error, returns -1 with errno set.
+ */
+
+int open_unix_listenfd(const char *path, int backlog) {
+  struct sockaddr_un addr = {.sun_family = AF_UNIX};
+  int listenfd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if ((listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+
+  /* Only a socket may be replaced, never a regular file. */
+  struct stat st;
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listenfd, backlog) < 0) {
+    int saved = errno;
+    close(listenfd);
+    errno = saved;
+    return -1;
+  }
+  return listenfd;
+}
+
+int Open_unix_listenfd(const char *path, int backlog) {
+  int rc = open_unix_listenfd(path, backlog);
+
+  if (rc < 0)
+    unix_error("Open_unix_listenfd error");
+  return rc;
+}
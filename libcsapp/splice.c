@@ -0,0 +1,20 @@
+#include "csapp.h"
+
+#ifdef LINUX
+#include <asm/unistd.h>
+
+/*
+ * tee, splice - Duplicate or move data between pipes without copying it
+ *     through user space. Glibc declares them only with _GNU_SOURCE.
+ *     On error, return -1 with errno set.
+ */
+
+ssize_t tee(int fdin, int fdout, size_t len, unsigned flags) {
+  return syscall(__NR_tee, fdin, fdout, len, flags);
+}
+
+ssize_t splice(int fdin, off_t *offin, int fdout, off_t *offout, size_t len,
+               unsigned flags) {
+  return syscall(__NR_splice, fdin, offin, fdout, offout, len, flags);
+}
+#endif
@@ -0,0 +1,548 @@
+/* In-process microbenchmarks of the shell's hot paths: tokenizer, `strapp`,
+ * redirection processing, job table operations, history search, PATH
+ * index and pathname expansion.
+ *
+ * Usage: microbench [-c] [-t msec] [benchmark-prefix...]
+ *
+ * Each benchmark is repeated until it runs for at least `msec` milliseconds
+ * (100 by default). Reported figures are nanoseconds and memory allocations
+ * per operation. With `-c` hardware counters are read with perf_event_open(2)
+ * and reported per operation as well.
+ *
+ * Shell's objects are linked in, and `do_redir` and the job table are
+ * benchmarked through shell.h, without a terminal. */
+
+#include "shell.h"
+
+#include <glob.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+/* Memory allocations are counted by wrapping allocator functions at link
+ * time (see `-Wl,--wrap` in Makefile). */
+static uint64_t nallocs = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size) {
+  nallocs++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+  nallocs++;
+  return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  nallocs++;
+  return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s) {
+  nallocs++;
+  return __real_strdup(s);
+}
+
+/* Command lines resembling what users actually type. */
+static const char *corpus[] = {
+  "ls -la /usr/share/doc",
+  "grep -rn TODO src include | sort | uniq -c | sort -rn | head -20",
+  "make -j8 all > build.log",
+  "cat < /etc/passwd | cut -d: -f1 | sort > users.txt",
+  "sleep 10 &",
+  "git log --oneline --graph --decorate --all | less",
+  "ps aux | grep -v grep | grep shell | awk {print}",
+  "tar czf backup.tar.gz docs src tests",
+  "./configure --prefix=/usr/local && make && make install",
+  "echo hello ; echo world",
+  "wc -l < input.txt > count.txt",
+  "vim shell.c",
+  NULL};
+
+/* Redirections target /dev/null, since `do_redir` really opens files. */
+static const char *redir_corpus[] = {
+  "cat < /dev/null > /dev/null",
+  "sort -u < /dev/null",
+  "make -j8 all > /dev/null",
+  "wc -l < /dev/null > /dev/null",
+  "grep -rn TODO src include",
+  NULL};
+
+/* Synthetic extremes. */
+#define MANY_TOKENS 10000
+#define MANY_PIPES 1000
+
+static char *many_tokens;
+static char *many_pipes;
+
+static char *repeat(const char *word, const char *sep, int n) {
+  size_t wl = strlen(word), sl = strlen(sep);
+  char *s = malloc(n * (wl + sl) + 1), *p = s;
+  for (int i = 0; i < n; i++) {
+    memcpy(p, word, wl), p += wl;
+    if (i < n - 1)
+      memcpy(p, sep, sl), p += sl;
+  }
+  *p = '\0';
+  return s;
+}
+
+/* Line buffer for `tokenize`, which modifies its input in place. */
+static char *linebuf;
+
+static int tokenize_copy(const char *line) {
+  int ntokens;
+  strcpy(linebuf, line);
+  free(tokenize(linebuf, &ntokens));
+  return ntokens;
+}
+
+static int corpus_idx = 0;
+
+static const char *next_line(const char **lines) {
+  if (lines[corpus_idx] == NULL)
+    corpus_idx = 0;
+  return lines[corpus_idx++];
+}
+
+static void bench_tokenize_corpus(void) {
+  tokenize_copy(next_line(corpus));
+}
+
+static void bench_tokenize_tokens(void) {
+  tokenize_copy(many_tokens);
+}
+
+static void bench_tokenize_pipes(void) {
+  tokenize_copy(many_pipes);
+}
+
+/* Expansion of set and unset variables. */
+static void setup_expand(void) {
+  setvar("MB_WORD", "expanded", false);
+}
+
+static void bench_tokenize_expand(void) {
+  tokenize_copy("cc -o $MB_WORD ${MB_WORD}.c $MB_UNSET -DSTATUS=$?");
+}
+
+static void teardown_expand(void) {
+  unsetvar("MB_WORD");
+}
+
+/* Command substitution of builtins, which runs without fork. */
+static void bench_tokenize_subst(void) {
+  tokenize_copy("echo $(echo hello | echo world) $(pwd)");
+}
+
+/* Environment for `execve` when no exported variable has changed. */
+static void bench_vars_envp(void) {
+  getenvp();
+}
+
+/* Words of each corpus line are joined with `strapp`, as `mkcommand` does. */
+static token_t *strapp_words = NULL;
+static int strapp_nwords = 0;
+
+static void setup_strapp(const char *line) {
+  strapp_words = tokenize(strcpy(linebuf, line), &strapp_nwords);
+}
+
+static void setup_strapp_words(void) {
+  setup_strapp(many_tokens);
+}
+
+static void bench_strapp(void) {
+  char *s = NULL;
+  for (int i = 0; i < strapp_nwords; i++)
+    strapp(&s, strapp_words[i]);
+  free(s);
+}
+
+static void teardown_strapp(void) {
+  free(strapp_words);
+  strapp_words = NULL;
+}
+
+/* Each operation restores tokens from a template, since `do_redir`
+ * overwrites them. */
+typedef struct redir_line {
+  char *line;
+  token_t *token;
+  int ntokens;
+} redir_line_t;
+
+static redir_line_t redir_lines[16];
+static int redir_nlines = 0;
+static int redir_idx = 0;
+static token_t *redir_work = NULL;
+
+static void redir_add(const char *line) {
+  redir_line_t *rl = &redir_lines[redir_nlines++];
+  rl->line = strdup(line);
+  rl->token = tokenize(rl->line, &rl->ntokens);
+}
+
+static void setup_redir_corpus(void) {
+  for (const char **line = redir_corpus; *line; line++)
+    redir_add(*line);
+  redir_work = malloc(sizeof(token_t) * 16);
+}
+
+static void setup_redir_tokens(void) {
+  redir_add(many_tokens);
+  redir_work = malloc(sizeof(token_t) * (MANY_TOKENS + 1));
+}
+
+static void bench_redir(void) {
+  redir_line_t *rl = &redir_lines[redir_idx];
+  redir_t r;
+
+  if (++redir_idx == redir_nlines)
+    redir_idx = 0;
+  memcpy(redir_work, rl->token, sizeof(token_t) * (rl->ntokens + 1));
+  redir_init(&r, -1, -1);
+  do_redir(redir_work, rl->ntokens, &r);
+  redir_done(&r);
+}
+
+static void teardown_redir(void) {
+  for (int i = 0; i < redir_nlines; i++) {
+    free(redir_lines[i].line);
+    free(redir_lines[i].token);
+  }
+  free(redir_work);
+  redir_nlines = redir_idx = 0;
+  redir_work = NULL;
+}
+
+/* Job table is exercised without any real processes. */
+#define LIVE_JOBS 1000
+
+static char *proc_argv[] = {"cat", "-n", "file.txt", NULL};
+
+static void bench_job_cycle(void) {
+  int j = addjob(1, BG);
+  for (int p = 0; p < 3; p++)
+    addproc(j, 1 + p, proc_argv);
+  dropjob(j);
+}
+
+static void setup_live_jobs(void) {
+  for (int i = 0; i < LIVE_JOBS; i++)
+    addproc(addjob(1, BG), 1, proc_argv);
+}
+
+static void teardown_live_jobs(void) {
+  forgetjobs();
+}
+
+static void bench_job_pipes(void) {
+  int j = addjob(1, BG);
+  for (int p = 0; p < MANY_PIPES; p++)
+    addproc(j, 1 + p, proc_argv);
+  dropjob(j);
+}
+
+/* History search over a million commands, kept in memory. */
+#define HISTORY_SIZE 1000000
+
+static void setup_history(void) {
+  char cmd[64];
+
+  if (history_count() > 0)
+    return;
+  for (int i = 0; i < HISTORY_SIZE; i++) {
+    snprintf(cmd, sizeof(cmd), "%s %d", corpus[i % 12], i);
+    history_append(cmd, i, i, 0);
+  }
+  /* Build the index before measurements start. */
+  history_find("xyz", INT_MAX);
+}
+
+static void bench_history_rare(void) {
+  history_find("uniq -c | sort -rn | head -20 99999", INT_MAX);
+}
+
+static void bench_history_common(void) {
+  history_find("make", INT_MAX);
+}
+
+/* PATH index over a directory with 10k executables. */
+#define NEXECUTABLES 10000
+
+static char bindir[] = "/tmp/microbench.XXXXXX";
+static char *oldpath = NULL;
+
+static void setup_pathindex(void) {
+  char name[PATH_MAX];
+
+  if (mkdtemp(bindir) == NULL)
+    unix_error("mkdtemp error");
+  for (int i = 0; i < NEXECUTABLES; i++) {
+    snprintf(name, sizeof(name), "%s/cmd%05d", bindir, i);
+    Close(Open(name, O_WRONLY | O_CREAT, 0755));
+  }
+  oldpath = strdup(getvar("PATH"));
+  setvar("PATH", bindir, true);
+  pathindex_refresh();
+}
+
+static void bench_pathindex_scan(void) {
+  /* Changing PATH drops all scans. */
+  setvar("PATH", "/", true);
+  pathindex_refresh();
+  setvar("PATH", bindir, true);
+  pathindex_refresh();
+}
+
+static void bench_pathindex_refresh(void) {
+  pathindex_refresh();
+}
+
+static void bench_pathindex_lookup(void) {
+  pathindex_lookup("cmd05000");
+}
+
+static void bench_pathindex_complete(void) {
+  int count;
+  pathindex_complete("cmd05", &count);
+}
+
+static void teardown_pathindex(void) {
+  char name[PATH_MAX];
+
+  for (int i = 0; i < NEXECUTABLES; i++) {
+    snprintf(name, sizeof(name), "%s/cmd%05d", bindir, i);
+    unlink(name);
+  }
+  rmdir(bindir);
+  strcpy(bindir + strlen(bindir) - 6, "XXXXXX");
+  setvar("PATH", oldpath, true);
+  free(oldpath);
+}
+
+/* Pathname expansion in a directory with 100k files, 1% of which match,
+ * compared with glob(3). */
+#define NGLOBFILES 100000
+
+static char globdir[] = "/tmp/microbench.XXXXXX";
+static char globpat[PATH_MAX];
+
+static void setup_glob(void) {
+  char name[PATH_MAX];
+
+  if (mkdtemp(globdir) == NULL)
+    unix_error("mkdtemp error");
+  for (int i = 0; i < NGLOBFILES; i++) {
+    snprintf(name, sizeof(name), "%s/file%06d.%s", globdir, i,
+             i % 100 ? "txt" : "log");
+    Close(Open(name, O_WRONLY | O_CREAT, 0644));
+  }
+  snprintf(globpat, sizeof(globpat), "%s/*.log", globdir);
+}
+
+static void bench_glob(void) {
+  int count;
+  free(glob_expand(globpat, &count));
+}
+
+static void bench_glob_libc(void) {
+  glob_t g;
+  glob(globpat, 0, NULL, &g);
+  globfree(&g);
+}
+
+static void teardown_glob(void) {
+  char name[PATH_MAX];
+
+  for (int i = 0; i < NGLOBFILES; i++) {
+    snprintf(name, sizeof(name), "%s/file%06d.%s", globdir, i,
+             i % 100 ? "txt" : "log");
+    unlink(name);
+  }
+  rmdir(globdir);
+  strcpy(globdir + strlen(globdir) - 6, "XXXXXX");
+}
+
+typedef struct bench {
+  const char *name;
+  void (*setup)(void);
+  void (*run)(void); /* performs a single operation */
+  void (*teardown)(void);
+} bench_t;
+
+static bench_t benchmarks[] = {
+  {"tokenize/corpus", NULL, bench_tokenize_corpus, NULL},
+  {"tokenize/10k-tokens", NULL, bench_tokenize_tokens, NULL},
+  {"tokenize/1k-pipes", NULL, bench_tokenize_pipes, NULL},
+  {"tokenize/expand", setup_expand, bench_tokenize_expand, teardown_expand},
+  {"tokenize/subst", NULL, bench_tokenize_subst, NULL},
+  {"vars/envp", NULL, bench_vars_envp, NULL},
+  {"strapp/10k-words", setup_strapp_words, bench_strapp, teardown_strapp},
+  {"redir/corpus", setup_redir_corpus, bench_redir, teardown_redir},
+  {"redir/10k-tokens", setup_redir_tokens, bench_redir, teardown_redir},
+  {"jobs/cycle", NULL, bench_job_cycle, NULL},
+  {"jobs/1k-live", setup_live_jobs, bench_job_cycle, teardown_live_jobs},
+  {"jobs/1k-pipes", NULL, bench_job_pipes, NULL},
+  {"history/1m-rare", setup_history, bench_history_rare, NULL},
+  {"history/1m-common", setup_history, bench_history_common, NULL},
+  {"path/10k-scan", setup_pathindex, bench_pathindex_scan, teardown_pathindex},
+  {"path/10k-refresh", setup_pathindex, bench_pathindex_refresh,
+   teardown_pathindex},
+  {"path/10k-lookup", setup_pathindex, bench_pathindex_lookup,
+   teardown_pathindex},
+  {"path/10k-complete", setup_pathindex, bench_pathindex_complete,
+   teardown_pathindex},
+  {"glob/100k-suffix", setup_glob, bench_glob, teardown_glob},
+  {"glob/100k-suffix-libc", setup_glob, bench_glob_libc, teardown_glob},
+  {NULL, NULL, NULL, NULL}};
+
+/* Hardware counters, each opened separately so that unsupported ones can be
+ * skipped. */
+typedef struct counter {
+  const char *name;
+  uint64_t config;
+  int fd;
+} counter_t;
+
+static counter_t counters[] = {
+  {"cycles", PERF_COUNT_HW_CPU_CYCLES, -1},
+  {"insns", PERF_COUNT_HW_INSTRUCTIONS, -1},
+  {"cache-miss", PERF_COUNT_HW_CACHE_MISSES, -1},
+  {"branch-miss", PERF_COUNT_HW_BRANCH_MISSES, -1},
+};
+
+#define NCOUNTERS (int)(sizeof(counters) / sizeof(counters[0]))
+
+static bool perf_open(void) {
+  bool any = false;
+
+  for (int i = 0; i < NCOUNTERS; i++) {
+    struct perf_event_attr attr = {
+      .type = PERF_TYPE_HARDWARE,
+      .size = sizeof(struct perf_event_attr),
+      .config = counters[i].config,
+      .disabled = 1,
+      .exclude_kernel = 1,
+      .exclude_hv = 1,
+    };
+    counters[i].fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (counters[i].fd < 0)
+      fprintf(stderr, "perf_event_open(%s): %s\n", counters[i].name,
+              strerror(errno));
+    else
+      any = true;
+  }
+
+  return any;
+}
+
+static void perf_start(void) {
+  for (int i = 0; i < NCOUNTERS; i++) {
+    if (counters[i].fd < 0)
+      continue;
+    ioctl(counters[i].fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counters[i].fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+static void perf_stop(uint64_t *value) {
+  for (int i = 0; i < NCOUNTERS; i++) {
+    value[i] = 0;
+    if (counters[i].fd < 0)
+      continue;
+    ioctl(counters[i].fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(counters[i].fd, &value[i], sizeof(uint64_t)) != sizeof(uint64_t))
+      value[i] = 0;
+  }
+}
+
+static void run(bench_t *b, uint64_t mintime, bool perf) {
+  uint64_t iters, elapsed, allocs, value[NCOUNTERS];
+
+  if (b->setup)
+    b->setup();
+
+  /* Double the number of iterations till the batch takes long enough. */
+  for (iters = 1;; iters *= 2) {
+    uint64_t start_allocs = nallocs;
+    if (perf)
+      perf_start();
+    uint64_t start = stats_clock();
+    for (uint64_t i = 0; i < iters; i++)
+      b->run();
+    elapsed = stats_clock() - start;
+    if (perf)
+      perf_stop(value);
+    allocs = nallocs - start_allocs;
+    if (elapsed >= mintime)
+      break;
+  }
+
+  if (b->teardown)
+    b->teardown();
+
+  printf("%-20s %10lu %12.1f %10.2f", b->name, iters,
+         (double)elapsed / iters, (double)allocs / iters);
+  for (int i = 0; perf && i < NCOUNTERS; i++) {
+    if (counters[i].fd < 0)
+      printf(" %12s", "-");
+    else
+      printf(" %12.1f", (double)value[i] / iters);
+  }
+  printf("\n");
+}
+
+static bool selected(const char *name, int argc, char **argv) {
+  if (argc == 0)
+    return true;
+  for (int i = 0; i < argc; i++)
+    if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+      return true;
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t mintime = 100;
+  bool perf = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "ct:")) != -1) {
+    if (opt == 'c')
+      perf = true;
+    else if (opt == 't')
+      mintime = atoi(optarg);
+    else
+      app_error("Usage: %s [-c] [-t msec] [benchmark-prefix...]", argv[0]);
+  }
+
+  if (perf)
+    perf = perf_open();
+
+  initvars();
+
+  many_tokens = repeat("word", " ", MANY_TOKENS);
+  many_pipes = repeat("cat", " | ", MANY_PIPES);
+  linebuf = malloc(strlen(many_pipes) + strlen(many_tokens) + 1);
+  initjobs(false);
+
+  printf("%-20s %10s %12s %10s", "benchmark", "iters", "ns/op", "allocs/op");
+  for (int i = 0; perf && i < NCOUNTERS; i++)
+    printf(" %12s", counters[i].name);
+  printf("\n");
+
+  for (bench_t *b = benchmarks; b->name; b++)
+    if (selected(b->name, argc - optind, argv + optind))
+      run(b, mintime * 1000000, perf);
+
+  free(linebuf);
+  free(many_pipes);
+  free(many_tokens);
+  return 0;
+}
@@ -0,0 +1,236 @@
+#include "shell.h"
+
+#include <dirent.h>
+
+/* Index of executables found in PATH directories. Each directory is scanned
+ * with getdents64 into a sorted array of names and rescanned only when its
+ * modification time changes. The index is refreshed before each prompt, so
+ * command lookup and completion never touch the directories themselves.
+ *
+ * The refresh is synchronous: when nothing changed it costs one stat per
+ * directory. A thread would have to lock the index against lookups and
+ * survive fork, and an inotify descriptor would stay open in the shell,
+ * which must not keep anything beyond the terminal. */
+
+typedef struct bindir {
+  char *path;            /* directory taken from PATH */
+  struct timespec mtime; /* modification time at the last scan */
+  bool scanned;          /* true if `mtime` and `name` are valid */
+  bool failed;           /* directory couldn't be read at the last scan */
+  char *pool;            /* storage for names */
+  const char **name;     /* names of executables, sorted */
+  int n;                 /* number of names */
+} bindir_t;
+
+static char *pathvar = NULL;    /* value of PATH the index was built for */
+static bool relative = false;   /* PATH has components relative to cwd */
+static bindir_t *dirs = NULL;   /* directories in order of PATH */
+static int ndirs = 0;           /* number of directories */
+static const char **all = NULL; /* names from all directories, sorted */
+static int nall = 0;            /* number of unique names in `all` */
+
+static int namecmp(const void *a, const void *b) {
+  return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void clear(bindir_t *d) {
+  free(d->pool);
+  free(d->name);
+  d->pool = NULL;
+  d->name = NULL;
+  d->n = 0;
+}
+
+/* Is directory entry an executable file? */
+static bool executable(int dirfd, struct linux_dirent64 *ent) {
+  if (ent->d_type != DT_REG && ent->d_type != DT_LNK &&
+      ent->d_type != DT_UNKNOWN)
+    return false;
+
+  /* Symbolic links and entries of unknown type may point to directories. */
+  if (ent->d_type != DT_REG) {
+    struct stat sb;
+    if (fstatat(dirfd, ent->d_name, &sb, 0) < 0 || !S_ISREG(sb.st_mode))
+      return false;
+  }
+
+  return faccessat(dirfd, ent->d_name, X_OK, AT_EACCESS) == 0;
+}
+
+/* A directory that can't be read is left empty and marked as failed. */
+static void scan(bindir_t *d) {
+  clear(d);
+  d->failed = false;
+
+  int fd = open(d->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  char buf[32768];
+  size_t size = 0, cap = 4096;
+  char *pool = malloc(cap);
+  int n, count = 0;
+
+  struct linux_dirent64 *dents = (struct linux_dirent64 *)buf;
+  while ((n = getdents64(fd, dents, sizeof(buf))) > 0) {
+    for (int off = 0; off < n;) {
+      struct linux_dirent64 *ent = (struct linux_dirent64 *)(buf + off);
+      off += ent->d_reclen;
+      if (ent->d_name[0] == '.' || !executable(fd, ent))
+        continue;
+      size_t len = strlen(ent->d_name) + 1;
+      while (size + len > cap)
+        pool = realloc(pool, cap *= 2);
+      memcpy(pool + size, ent->d_name, len);
+      size += len;
+      count++;
+    }
+  }
+  close(fd);
+
+  if (n < 0) {
+    free(pool);
+    d->failed = true;
+    return;
+  }
+
+  /* Names can be pointed to only when the pool doesn't move anymore. */
+  d->pool = pool;
+  d->name = malloc(sizeof(char *) * count);
+  for (char *s = pool; d->n < count; s += strlen(s) + 1)
+    d->name[d->n++] = s;
+  qsort(d->name, d->n, sizeof(char *), namecmp);
+}
+
+/* Merge names from all directories into single sorted array without
+ * duplicates. */
+static void merge(void) {
+  nall = 0;
+  for (int i = 0; i < ndirs; i++)
+    nall += dirs[i].n;
+
+  all = realloc(all, sizeof(char *) * (nall + 1));
+  for (int i = 0, k = 0; i < ndirs; i++) {
+    memcpy(all + k, dirs[i].name, sizeof(char *) * dirs[i].n);
+    k += dirs[i].n;
+  }
+  qsort(all, nall, sizeof(char *), namecmp);
+
+  int u = 0;
+  for (int i = 0; i < nall; i++)
+    if (u == 0 || strcmp(all[u - 1], all[i]))
+      all[u++] = all[i];
+  nall = u;
+}
+
+/* Split PATH into directories. Old scans are dropped. */
+static void setpath(const char *path) {
+  for (int i = 0; i < ndirs; i++) {
+    clear(&dirs[i]);
+    free(dirs[i].path);
+  }
+  free(pathvar);
+
+  pathvar = strdup(path);
+  relative = false;
+  ndirs = 0;
+
+  for (const char *s = path; *s;) {
+    size_t len = strcspn(s, ":");
+    if (len > 0 && s[0] == '/') {
+      dirs = realloc(dirs, sizeof(bindir_t) * (ndirs + 1));
+      dirs[ndirs++] = (bindir_t){.path = strndup(s, len)};
+    } else {
+      /* Empty component means current working directory. */
+      relative = true;
+    }
+    s += len;
+    if (*s == ':' && *++s == '\0')
+      relative = true;
+  }
+}
+
+/* Bring the index up to date with PATH and directory contents. */
+void pathindex_refresh(void) {
+  const char *path = getvar("PATH");
+  bool changed = false;
+
+  if (path == NULL)
+    path = "";
+
+  if (pathvar == NULL || strcmp(pathvar, path)) {
+    setpath(path);
+    changed = true;
+  }
+
+  for (int i = 0; i < ndirs; i++) {
+    bindir_t *d = &dirs[i];
+    struct stat sb;
+
+    if (stat(d->path, &sb) < 0) {
+      if (d->scanned) {
+        clear(d);
+        d->scanned = false;
+        changed = true;
+      }
+      continue;
+    }
+
+    if (d->scanned && d->mtime.tv_sec == sb.st_mtim.tv_sec &&
+        d->mtime.tv_nsec == sb.st_mtim.tv_nsec)
+      continue;
+
+    /* A failed scan is retried at the next refresh. */
+    scan(d);
+    d->mtime = sb.st_mtim;
+    d->scanned = !d->failed;
+    changed = true;
+  }
+
+  if (changed)
+    merge();
+}
+
+/* Returns absolute path of the executable that `execvp` would run, or NULL
+ * if the index can't tell. Result is valid till next call. */
+const char *pathindex_lookup(const char *name) {
+  static char exe[PATH_MAX];
+  const char *path = getvar("PATH");
+
+  if (pathvar == NULL || relative || path == NULL || strcmp(pathvar, path))
+    return NULL;
+
+  for (int i = 0; i < ndirs; i++) {
+    /* The command may be in a directory that couldn't be read. */
+    if (dirs[i].failed)
+      return NULL;
+    if (bsearch(&name, dirs[i].name, dirs[i].n, sizeof(char *), namecmp)) {
+      snprintf(exe, sizeof(exe), "%s/%s", dirs[i].path, name);
+      return exe;
+    }
+  }
+
+  return NULL;
+}
+
+/* Returns sorted names of executables starting with `prefix`. Their number
+ * is stored at `countp`. */
+const char **pathindex_complete(const char *prefix, int *countp) {
+  size_t len = strlen(prefix);
+  int lo = 0, hi = nall;
+
+  /* Find the first name not less than the prefix. */
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (strcmp(all[mid], prefix) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (hi = lo; hi < nall && !strncmp(all[hi], prefix, len); hi++)
+    continue;
+
+  *countp = hi - lo;
+  return all ? all + lo : NULL;
+}
@@ -0,0 +1,155 @@
+#include "shell.h"
+
+/* Table of descriptors of a command being started, filled in by do_redir.
+ * A pipeline stage begins with its pipe ends as standard input and output.
+ * Redirections are applied on top of that from left to right, so ">f 2>&1"
+ * sends both outputs to f, while "2>&1 >f" sends errors where output went
+ * before. Descriptors the shell opens for a command are close-on-exec, and
+ * the shell closes them once the command has started. */
+
+static fd_set userfds; /* descriptors opened by "exec" */
+
+static int lookup(redir_t *r, int fd) {
+  for (int i = 0; i < r->n; i++)
+    if (r->move[i].dst == fd)
+      return i;
+  return -1;
+}
+
+/* Close a descriptor opened for the command once nothing refers to it. */
+static void release(redir_t *r, int fd) {
+  for (int i = 0; i < r->n; i++)
+    if (r->move[i].src == fd)
+      return;
+  for (int i = 0; i < r->nopened; i++) {
+    if (r->opened[i] == fd) {
+      Close(fd);
+      r->opened[i] = r->opened[--r->nopened];
+      return;
+    }
+  }
+}
+
+void redir_init(redir_t *r, int input, int output) {
+  *r = (redir_t){};
+  /* Pipe ends are created close-on-exec. */
+  if (input >= 0)
+    redir_set(r, STDIN_FILENO, input, true);
+  if (output >= 0)
+    redir_set(r, STDOUT_FILENO, output, true);
+}
+
+/* Make `dst` a copy of `src` (or closed if it's -1). */
+void redir_set(redir_t *r, int dst, int src, bool cloexec) {
+  int i = lookup(r, dst);
+
+  if (i < 0) {
+    r->move = realloc(r->move, sizeof(fdmove_t) * (r->n + 1));
+    i = r->n++;
+  } else {
+    int old = r->move[i].src;
+    r->move[i].src = -1;
+    release(r, old);
+  }
+
+  r->move[i] = (fdmove_t){.dst = dst, .src = src, .cloexec = cloexec};
+}
+
+/* Make `dst` refer to descriptor `fd` just opened for the command. */
+void redir_open(redir_t *r, int dst, int fd) {
+  r->opened = realloc(r->opened, sizeof(int) * (r->nopened + 1));
+  r->opened[r->nopened++] = fd;
+  redir_set(r, dst, fd, true);
+}
+
+/* Returns the shell's descriptor that `fd` of the command refers to, or -1 if
+ * it's closed. Internal descriptors of the shell are close-on-exec, so they
+ * are not visible to commands. Neither are those opened by "exec", unless a
+ * command is given one explicitly. */
+int redir_source(redir_t *r, int fd, bool *cloexecp) {
+  int i = lookup(r, fd);
+  if (i >= 0) {
+    if (cloexecp)
+      *cloexecp = r->move[i].cloexec;
+    return r->move[i].src;
+  }
+
+  if (fd < FD_SETSIZE && FD_ISSET(fd, &userfds)) {
+    if (cloexecp)
+      *cloexecp = true;
+    return fd;
+  }
+
+  int flags = fcntl(fd, F_GETFD);
+  if (flags < 0 || (flags & FD_CLOEXEC))
+    return -1;
+  if (cloexecp)
+    *cloexecp = false;
+  return fd;
+}
+
+/* Applies redirections to the shell itself, as "exec 3>>log" does, so that
+ * commands can refer to the descriptors without opening files again. Returns
+ * -1 if the shell's descriptors couldn't be changed. */
+int redir_persist(redir_t *r) {
+  for (int i = 0; i < r->n; i++) {
+    int fd = r->move[i].dst;
+    bool source = false;
+    for (int j = 0; j < r->n; j++)
+      source |= r->move[j].src == fd;
+    if (fd >= FD_SETSIZE) {
+      msg("exec: %d: %s\n", fd, strerror(EBADF));
+      return -1;
+    }
+    if (fd <= STDERR_FILENO || source || FD_ISSET(fd, &userfds))
+      continue;
+    /* Descriptors inherited by the shell are the user's too. */
+    releasefd(fd);
+    int flags = fcntl(fd, F_GETFD);
+    if (flags >= 0 && (flags & FD_CLOEXEC)) {
+      msg("exec: %d: descriptor is used by the shell\n", fd);
+      return -1;
+    }
+  }
+
+  fdop_t op[2 * r->n + 1];
+  if (fdmove_apply(op, fdmove_plan(r->move, r->n, op)) < 0) {
+    msg("exec: %s\n", strerror(errno));
+    return -1;
+  }
+
+  for (int i = 0; i < r->n; i++) {
+    int fd = r->move[i].dst;
+
+    /* An opened descriptor that got overwritten now belongs to the user. */
+    for (int j = 0; j < r->nopened; j++)
+      if (r->opened[j] == fd)
+        r->opened[j--] = r->opened[--r->nopened];
+
+    if (fd <= STDERR_FILENO)
+      continue;
+    if (r->move[i].src < 0) {
+      FD_CLR(fd, &userfds);
+    } else {
+      FD_SET(fd, &userfds);
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+  }
+
+  return 0;
+}
+
+/* Makes descriptor `fd` of the shell available to commands that name it, as
+ * if it was opened by "exec". */
+void redir_adopt(int fd) {
+  if (fd < FD_SETSIZE)
+    FD_SET(fd, &userfds);
+}
+
+void redir_done(redir_t *r) {
+  for (int i = 0; i < r->nopened; i++)
+    Close(r->opened[i]);
+  free(r->opened);
+  free(r->move);
+  *r = (redir_t){};
+}
@@ -0,0 +1,205 @@
+#include "shell.h"
+#include "server.h"
+
+#include <sys/sendfile.h>
+
+/* Command server, started with --server PATH. Automation that would start a
+ * new shell for every command connects to the socket instead, and commands
+ * run in this one through the usual `eval`, so they become its jobs. The
+ * server has no terminal.
+ *
+ * The loop below multiplexes clients with poll: it accepts connections and
+ * collects requests from all of them as data arrives. A complete request is
+ * run right away with standard descriptors of the shell replaced by those
+ * sent by the client, and the reply is sent back. Commands run one at a
+ * time, as a shell runs them. A request with "&" returns at once and its job
+ * keeps running. */
+
+#define MAXCLIENTS 64
+
+typedef struct client {
+  int fd;
+  srvreq_t req;
+  size_t got; /* bytes of the current request received so far */
+  char *data; /* strings of the request */
+  int fds[SRV_MAXFDS];
+  int nfds;
+} client_t;
+
+static client_t client[MAXCLIENTS];
+static int nclients = 0;
+static int stdfd[3]; /* standard descriptors of the server itself */
+static int devnull = -1;
+
+static void forget(client_t *c) {
+  for (int i = 0; i < c->nfds; i++)
+    Close(c->fds[i]);
+  free(c->data);
+  c->data = NULL;
+  c->got = 0;
+  c->nfds = 0;
+}
+
+/* Reads whatever has arrived of the current request. Returns 1 once the
+ * request is complete, 0 if more is to come and -1 if the client is gone or
+ * has sent something invalid. */
+static int receive(client_t *c) {
+  char control[CMSG_SPACE(sizeof(int) * SRV_MAXFDS)];
+  struct iovec iov;
+
+  if (c->got < sizeof(srvreq_t)) {
+    iov.iov_base = (char *)&c->req + c->got;
+    iov.iov_len = sizeof(srvreq_t) - c->got;
+  } else {
+    iov.iov_base = c->data + c->got - sizeof(srvreq_t);
+    iov.iov_len = sizeof(srvreq_t) + c->req.size - c->got;
+  }
+
+  struct msghdr mh = {.msg_iov = &iov,
+                      .msg_iovlen = 1,
+                      .msg_control = control,
+                      .msg_controllen = sizeof(control)};
+  ssize_t n = recvmsg(c->fd, &mh, MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+  if (n < 0 && (errno == EINTR || errno == EAGAIN))
+    return 0;
+  if (n <= 0)
+    return -1;
+
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+    int *fds = (int *)CMSG_DATA(cm);
+    int k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    for (int i = 0; i < k; i++) {
+      if (c->nfds < SRV_MAXFDS)
+        c->fds[c->nfds++] = fds[i];
+      else
+        Close(fds[i]);
+    }
+  }
+
+  c->got += n;
+  if (c->got == sizeof(srvreq_t)) {
+    /* Each assignment takes at least two bytes, "=" and NUL. */
+    if (c->req.size == 0 || c->req.size > SRV_MAXREQ || c->req.envc < 0 ||
+        (uint32_t)c->req.envc > c->req.size / 2)
+      return -1;
+    c->data = malloc(c->req.size + 1);
+    c->data[c->req.size] = '\0';
+    return 0;
+  }
+
+  return c->got == sizeof(srvreq_t) + c->req.size;
+}
+
+/* Next string of a request, or NULL if there's none. */
+static char *next(client_t *c, char *s) {
+  s += strlen(s) + 1;
+  return s < c->data + c->req.size ? s : NULL;
+}
+
+/* Runs the command of a complete request and replies. */
+static bool execute(client_t *c, int (*eval)(char *)) {
+  char *cwd = c->data;
+  char *line = next(c, cwd);
+  char **env = malloc(sizeof(char *) * (c->req.envc + 1));
+  int nenv = 0;
+
+  for (char *s = line; s && nenv < c->req.envc; nenv++)
+    if ((env[nenv] = s = next(c, s)) == NULL || !assignment_p(s))
+      break;
+  if (line == NULL || nenv < c->req.envc) {
+    free(env);
+    return false;
+  }
+
+  int output = -1;
+  if (c->req.flags & SRV_CAPTURE)
+    output = Memfd_create("output", MFD_CLOEXEC);
+
+  for (int i = 0; i < 3; i++) {
+    int fd = i < c->nfds ? c->fds[i] : devnull;
+    Dup2(i == STDOUT_FILENO && output >= 0 ? output : fd, i);
+  }
+
+  srvreply_t reply = {.status = 1};
+  if (chdir(cwd) < 0) {
+    msg("%s: %s\n", cwd, strerror(errno));
+  } else {
+    pushvars(env, nenv);
+    pathindex_refresh();
+    reply.status = eval(line);
+    setstatus(reply.status);
+    popvars();
+    watchjobs(FINISHED);
+  }
+  free(env);
+
+  for (int i = 0; i < 3; i++)
+    Dup2(stdfd[i], i);
+
+  off_t offset = 0;
+  if (output >= 0)
+    reply.size = Lseek(output, 0, SEEK_END);
+
+  bool ok = send(c->fd, &reply, sizeof(reply), MSG_NOSIGNAL) == sizeof(reply);
+  while (ok && offset < (off_t)reply.size) {
+    ssize_t n = sendfile(c->fd, output, &offset, reply.size - offset);
+    ok = n > 0 || (n < 0 && errno == EINTR);
+  }
+
+  if (output >= 0)
+    Close(output);
+  return ok;
+}
+
+static void drop(int i) {
+  forget(&client[i]);
+  Close(client[i].fd);
+  client[i] = client[--nclients];
+}
+
+noreturn void serve(const char *path, int (*eval)(char *)) {
+  int listenfd = Open_unix_listenfd(path, MAXCLIENTS);
+
+  /* Commands get descriptors of clients, so ours are put aside. */
+  devnull = Open("/dev/null", O_RDWR | O_CLOEXEC, 0);
+  for (int i = 0; i < 3; i++)
+    if ((stdfd[i] = fcntl(i, F_DUPFD_CLOEXEC, 10)) < 0)
+      stdfd[i] = devnull;
+
+  struct pollfd pfd[MAXCLIENTS + 1];
+
+  for (;;) {
+    joblog_flush();
+    watchjobs(FINISHED);
+
+    pfd[0] = (struct pollfd){.fd = listenfd, .events = POLLIN};
+    for (int i = 0; i < nclients; i++)
+      pfd[i + 1] = (struct pollfd){.fd = client[i].fd, .events = POLLIN};
+
+    /* Returns 0 if a finished job has interrupted it. */
+    if (Poll(pfd, nclients + 1, -1) == 0)
+      continue;
+
+    /* Clients are served from the last one, so dropping one is safe. */
+    for (int i = nclients - 1; i >= 0; i--) {
+      if (!(pfd[i + 1].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+      int rc = receive(&client[i]);
+      if (rc > 0 && execute(&client[i], eval))
+        forget(&client[i]);
+      else if (rc != 0)
+        drop(i);
+    }
+
+    if (pfd[0].revents & POLLIN) {
+      int fd = accept(listenfd, NULL, NULL);
+      if (fd >= 0 && nclients == MAXCLIENTS) {
+        Close(fd);
+      } else if (fd >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        client[nclients++] = (client_t){.fd = fd};
+      }
+    }
+  }
+}
@@ -0,0 +1,32 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdint.h>
+
+/* Protocol of the command server (server.c). A client connects to the UNIX
+ * socket given with --server and sends requests, one at a time. A request
+ * header is followed by `size` bytes of NUL-terminated strings: working
+ * directory, command line and `envc` NAME=value assignments that apply to
+ * this command only. The header may carry up to three descriptors as
+ * SCM_RIGHTS, that become standard input, output and error of the command.
+ * Missing ones are /dev/null. With SRV_CAPTURE standard output is captured
+ * and sent back instead. The reply header carries exit status of the command
+ * and is followed by `size` bytes of captured output. */
+
+#define SRV_MAXFDS 3
+#define SRV_MAXREQ (1 << 20) /* largest request accepted */
+
+#define SRV_CAPTURE 1 /* send standard output back in the reply */
+
+typedef struct srvreq {
+  uint32_t size;  /* bytes of strings following the header */
+  uint32_t flags; /* SRV_* flags */
+  int32_t envc;   /* number of assignments */
+} srvreq_t;
+
+typedef struct srvreply {
+  int32_t status; /* exit status, as in $? */
+  uint32_t size;  /* bytes of captured output following the header */
+} srvreply_t;
+
+#endif /* !_SERVER_H_ */
@@ -8,9 +8,11 @@ import pexpect
 import unittest
 import subprocess
 import random
+import socket
+import struct
 import time
 import sys
-from tempfile import NamedTemporaryFile
+from tempfile import NamedTemporaryFile, TemporaryDirectory
 
 
 LOGFILE = 'sh-tests.{}.log'.format(os.getpid())
@@ -304,6 +306,251 @@ class TestShellSimple(ShellTesterSimple, unittest.TestCase):
         self.expect_exact("[1] killed 'sleep 1000' by signal 15")
         self.expect_exact("[2] killed 'sleep 2000' by signal 15")
 
+    def test_stats(self):
+        # output goes through redirections, pipes and command substitution
+        lines = self.execute('stats | head -n 1')
+        self.assertEqual(lines[0].split(),
+                         ['(usec)', 'count', 'mean', 'p50', 'p99', 'max'])
+        self.assertEqual(len(lines), 1)
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute(f'stats > {outf.name}')
+            self.assertIn('tokenize', outf.read())
+        self.assertIn('tokenize', self.execute('echo $(stats)')[0])
+
+    def test_history_search(self):
+        # nothing is indexed yet in a fresh shell
+        self.execute('history abc')
+        self.assertEqual(self.execute('echo ok'), ['ok'])
+        self.execute('echo abcd')
+        lines = self.execute('history bcd')
+        self.assertEqual(len(lines), 1)
+        self.assertTrue(lines[0].endswith('echo abcd'))
+
+        # output goes through pipes and redirections
+        self.assertEqual(self.execute('history abcd | wc -l'), ['1'])
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute(f'history echo abcd > {outf.name}')
+            self.assertTrue(outf.read().strip().endswith('echo abcd'))
+
+    def test_history_corrupt(self):
+        def record(cmd, size=None):
+            cmd = cmd.encode('utf-8') + b'\0'
+            cmd += b'\0' * (-(28 + len(cmd)) % 8)
+            return struct.pack('=IIqQi', 0x54534948, size or 28 + len(cmd),
+                               int(time.time()), 0, 0) + cmd
+
+        # a record cut short is skipped, later ones are still read
+        with NamedTemporaryFile(mode='wb') as histf:
+            histf.write(record('echo first'))
+            histf.write(record('echo cut short')[:36])
+            histf.write(record('echo last'))
+            histf.flush()
+            self.tearDown()
+            os.environ['SHELL_HISTORY'] = histf.name
+            try:
+                self.setUp()
+            finally:
+                del os.environ['SHELL_HISTORY']
+            lines = self.execute('history echo')
+            self.assertEqual(len(lines), 2)
+            self.assertTrue(lines[0].endswith('echo first'))
+            self.assertTrue(lines[1].endswith('echo last'))
+
+    def test_variables(self):
+        self.execute('X=hello')
+        self.assertEqual(self.execute('echo $X ${X}world'),
+                         ['hello helloworld'])
+        # not exported yet
+        self.assertEqual(self.execute('printenv X | wc -l'), ['0'])
+        self.execute('export X')
+        self.assertEqual(self.execute('printenv X'), ['hello'])
+        # assignment before a command lasts only for that command
+        self.assertEqual(self.execute('Y=once printenv Y'), ['once'])
+        self.assertEqual(self.execute('echo y=$Y'), ['y='])
+        self.execute('export X=changed')
+        self.assertEqual(self.execute('printenv X'), ['changed'])
+        # listing of exported variables goes through pipes
+        self.assertEqual(self.execute('export | grep -x export.X=changed'),
+                         ['export X=changed'])
+        self.execute('unset X')
+        self.assertEqual(self.execute('echo x=$X'), ['x='])
+        self.execute('false')
+        self.assertEqual(self.execute('echo $?'), ['1'])
+        self.assertEqual(self.execute('echo $$'), [str(self.pid)])
+
+    def test_command_substitution(self):
+        # output is split into words and glued to text around it
+        self.assertEqual(self.execute('echo a$(echo b c)d'), ['ab cd'])
+        self.assertEqual(self.execute('echo $(pwd)'), [os.getcwd()])
+        self.assertEqual(self.execute('echo x$(seq 3 | tail -n 2)'),
+                         ['x2 3'])
+        self.assertEqual(self.execute('echo [$(true)]'), ['[]'])
+
+    def test_glob(self):
+        with TemporaryDirectory() as d:
+            for name in ['a.c', 'b.c', 'c.h', 'sub/d.c']:
+                os.makedirs(os.path.dirname(os.path.join(d, name)),
+                            exist_ok=True)
+                open(os.path.join(d, name), 'w').close()
+            self.assertEqual(self.execute(f'echo {d}/*.c'),
+                             [f'{d}/a.c {d}/b.c'])
+            self.assertEqual(self.execute(f'echo {d}/?.h'), [f'{d}/c.h'])
+            self.assertEqual(self.execute(f'echo {d}/[ab].c'),
+                             [f'{d}/a.c {d}/b.c'])
+            self.assertEqual(self.execute(f'echo {d}/**/*.c'),
+                             [f'{d}/a.c {d}/b.c {d}/sub/d.c'])
+            # a pattern that matches nothing is left as it is
+            self.assertEqual(self.execute(f'echo {d}/*.x'), [f'{d}/*.x'])
+
+    def test_process_substitution(self):
+        lines = self.execute('cat <(seq 5 | wc -l) <(seq 2)')
+        self.assertEqual(lines, ['5', '1', '2'])
+
+        # the consumer may finish after the prompt is back
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute(f'seq 3 | tee >(wc -l > {outf.name}) > /dev/null')
+            for i in range(100):
+                text = outf.read()
+                if text:
+                    break
+                time.sleep(0.05)
+            self.assertEqual(text.strip(), '3')
+
+    def test_fanout(self):
+        # every consumer gets the whole output, even if another one quits
+        lines = self.execute('seq 100000 |> wc -l |> head -n 1 | tr 1 x')
+        self.assertEqual(sorted(lines), ['100000', 'x'])
+        with NamedTemporaryFile(mode='r') as outf:
+            lines = self.execute(
+                f'seq 1000 |> cat > {outf.name} |> tail -n 1')
+            self.assertEqual(lines, ['1000'])
+            self.assertEqual(outf.read().split(),
+                             [str(i) for i in range(1, 1001)])
+
+    def test_heredoc(self):
+        self.execute('X=world')
+        self.sendline('cat <<EOF')
+        self.expect_exact('>')
+        self.sendline('hello $X')
+        self.expect_exact('>')
+        self.sendline('EOF')
+        self.expect('#')
+        self.assertEqual(self.lines_before(), ['hello world'])
+        self.assertEqual(self.execute('wc -c <<<abc'), ['4'])
+
+    def test_redir_fd(self):
+        with NamedTemporaryFile(mode='w') as script, \
+             NamedTemporaryFile(mode='r') as outf:
+            script.write('echo out; echo err >&2\n')
+            script.flush()
+
+            # standard output and error swapped
+            self.execute(f'sh {script.name} 3>&1 1>&2 2>&3 3>&- | '
+                         f'cat > {outf.name}')
+            self.assertEqual(outf.read(), 'err\n')
+
+            # order matters: error goes where output went before
+            lines = self.execute(f'sh {script.name} 2>&1 >/dev/null | cat')
+            self.assertEqual(lines, ['err'])
+
+            self.execute(f'echo a > {outf.name}')
+            self.execute(f'echo b >> {outf.name}')
+            self.assertEqual(self.execute(f'cat 0<>{outf.name}'), ['a', 'b'])
+
+        # a failed redirection is reported and the command isn't run
+        lines = self.execute('echo ran > /nonexistent/file')
+        self.assertEqual(len(lines), 1)
+        self.assertIn('No such file or directory', lines[0])
+
+    def test_exec_redir(self):
+        with NamedTemporaryFile(mode='r') as outf:
+            self.execute(f'exec 5>{outf.name}')
+            self.execute('echo hi >&5')
+            self.execute('echo there >&5')
+            # not passed to commands that don't name it
+            self.assertEqual(self.execute('ls /proc/self/fd | wc -l'), ['4'])
+            self.execute('exec 5>&-')
+            lines = self.execute('echo late >&5')
+            self.assertIn('Bad file descriptor', lines[0])
+            self.assertEqual(outf.read(), 'hi\nthere\n')
+
+    def test_coproc(self):
+        self.sendline('coproc C cat')
+        self.expect_exact("[1] running 'cat'")
+        self.expect('#')
+        pid = int(self.execute('echo $C_PID')[0])
+        self.assertTrue(os.path.exists(f'/proc/{pid}'))
+        # the same process answers every time
+        for word in ['hello', 'again']:
+            self.execute(f'echo {word} >&$C')
+            self.assertEqual(self.execute('head -n1 <&$C'), [word])
+        self.sendline('exec $C>&-')
+        self.sendline('jobs')
+        self.expect_exact("[1] exited 'cat', status=0")
+
+    def test_monitor_jobs(self):
+        self.sendline('sleep 100 &')
+        self.expect_exact("[1] running 'sleep 100'")
+        self.expect('#')
+        # on a terminal the picture is refreshed until a key is pressed
+        self.sendline('jobs -r')
+        self.expect('JOB +STATE +PROCS +CPU% +RSS +READ +WRITE +COMMAND')
+        self.expect(r'\[1\] +running +S +[0-9.]+ +[0-9.]+[BKMG] .* sleep 100')
+        self.send('q')
+        self.expect('#')
+        self.sendline('kill %1')
+        self.sendline('jobs')
+        self.expect_exact("[1] killed 'sleep 100' by signal 15")
+
+    def test_spawn_server(self):
+        def parse(stat):
+            # command name, parent pid, process group
+            fields = stat[stat.rindex(')') + 2:].split()
+            name = stat[stat.index('(') + 1:stat.rindex(')')]
+            return name, int(fields[1]), int(fields[2])
+
+        self.tearDown()
+        os.environ['SHELL_SPAWND'] = './spawnd'
+        try:
+            self.setUp()
+        finally:
+            del os.environ['SHELL_SPAWND']
+
+        children = []
+        for pid in filter(str.isdigit, os.listdir('/proc')):
+            try:
+                with open(f'/proc/{pid}/stat') as f:
+                    name, ppid, pgrp = parse(f.read())
+            except OSError:
+                continue
+            if ppid == self.pid:
+                children.append(name)
+        self.assertIn('spawnd', children)
+
+        # a command is still a child of the shell, in a group of its own
+        line = self.execute('cat /proc/self/stat | cat')[0]
+        name, ppid, pgrp = parse(line)
+        self.assertEqual(ppid, self.pid)
+        self.assertEqual(pgrp, int(line.split()[0]))
+
+        self.execute('nonexistent')
+        self.assertEqual(self.execute('echo $?'), ['127'])
+
+        # descriptors of redirections are passed to the server
+        with NamedTemporaryFile(mode='w') as inf, \
+             NamedTemporaryFile(mode='r') as outf:
+            inf.write('passed\n')
+            inf.flush()
+            self.execute(f'cat < {inf.name} > {outf.name}')
+            self.assertEqual(outf.read(), 'passed\n')
+
+    def test_command_list(self):
+        # 'echo a; ls /' is rejected rather than passed to a builtin
+        for sep in [';', '&&', '||', '&']:
+            lines = self.execute(f'echo a {sep} ls /')
+            self.assertIn('syntax error', lines[-1])
+        self.assertEqual(self.execute('echo ok'), ['ok'])
+
 
 class TestShellWithSyscalls(ShellTester, unittest.TestCase):
     def stty(self):
@@ -353,6 +600,31 @@ class TestShellWithSyscalls(ShellTester, unittest.TestCase):
         self.sendline('jobs')
         self.expect_exact("[1] killed 'cat' by signal 15")
 
+    def test_command_substitution(self):
+        # builtins are evaluated within the shell
+        self.sendline('echo x$(echo hi)y $(pwd)')
+        self.expect('#')
+        before = self.child.before.decode('utf-8')
+        self.assertNotIn('fork()', before)
+        self.assertIn(f'xhiy {os.getcwd()}', before)
+
+        # other commands run in a subshell that reads their output
+        self.sendline('echo $(seq 2)')
+        subshell = self.expect_fork(parent=self.pid)['retval']
+        self.expect_fork(parent=subshell)
+        self.expect_waitpid(pid=subshell, status=0)
+        self.expect_exact('1 2')
+
+    def test_long_path(self):
+        with TemporaryDirectory(prefix='d' * 80) as d:
+            prog = os.path.join(d, 'true')
+            with open('/bin/true', 'rb') as src, open(prog, 'wb') as dst:
+                dst.write(src.read())
+            os.chmod(prog, 0o755)
+            self.sendline(prog)
+            self.expect_exact(f'execve("{prog}"')
+            self.expect('#')
+
     def test_termattr_1(self):
         stty_before = self.stty()
         self.sendline('more shell.c')
@@ -379,6 +651,152 @@ class TestShellWithSyscalls(ShellTester, unittest.TestCase):
         self.assertEqual(stty_before, stty_after)
 
 
+class TestShellCommand(unittest.TestCase):
+    def run_command(self, cmd, input=None, env=None):
+        return subprocess.run(['./shell', '-c', cmd], input=input,
+                              env=env and dict(os.environ, **env),
+                              capture_output=True, timeout=10, text=True)
+
+    def test_heredoc_in_command(self):
+        # body comes with the command, standard input is left alone
+        res = self.run_command('cat <<EOF\nhello $X\nEOF', input='stdin\n')
+        self.assertEqual(res.stdout, 'hello \n')
+        self.assertEqual(res.returncode, 0)
+
+        res = self.run_command('cat <<EOF', input='stdin\n')
+        self.assertIn('here-document without body', res.stderr)
+        self.assertEqual(res.returncode, 2)
+
+    def test_variable_not_evaluated(self):
+        # text of a variable is never taken for command substitution
+        with TemporaryDirectory() as d:
+            marker = os.path.join(d, 'marker')
+            res = self.run_command('echo $X ${X}y',
+                                   env={'X': f'$(touch {marker})'})
+            self.assertEqual(res.stdout,
+                             f'$(touch {marker}) $(touch {marker})y\n')
+            self.assertFalse(os.path.exists(marker))
+
+    def test_batch(self):
+        # arguments beyond ARG_MAX are split among several invocations
+        with NamedTemporaryFile(mode='r') as outf:
+            res = self.run_command(f'batch echo $(seq 400000) > {outf.name}')
+            self.assertEqual(res.returncode, 0)
+            lines = outf.read().splitlines()
+            self.assertGreater(len(lines), 1)
+            self.assertEqual(' '.join(lines).split(),
+                             [str(i) for i in range(1, 400001)])
+
+        # failures are reported as xargs does
+        with NamedTemporaryFile(mode='w') as script:
+            script.write('test "$1" = kill && kill -9 $$; exit $1\n')
+            script.flush()
+            for arg, code in [('0', 0), ('1', 123), ('255', 124),
+                              ('kill', 125)]:
+                res = self.run_command(f'batch sh {script.name} {arg}')
+                self.assertEqual(res.returncode, code)
+        self.assertEqual(self.run_command('batch nonexistent a').returncode,
+                         127)
+
+    def test_command(self):
+        res = self.run_command('echo a | tr a b')
+        self.assertEqual(res.stdout, 'b\n')
+        self.assertEqual(res.returncode, 0)
+
+        # status of the command becomes status of the shell
+        self.assertEqual(self.run_command('false').returncode, 1)
+        self.assertEqual(self.run_command('nonexistent').returncode, 127)
+
+        res = subprocess.run(['./shell', '--startup-profile', '-c', 'true'],
+                             capture_output=True, timeout=10, text=True)
+        self.assertIn('startup:', res.stderr)
+        self.assertEqual(res.returncode, 0)
+
+
+class TestShellServer(unittest.TestCase):
+    def setUp(self):
+        self.path = 'sh-tests.{}.sock'.format(os.getpid())
+        self.child = pexpect.spawn('./shell', ['--server', self.path])
+        self.child.logfile = open(LOGFILE, 'ab')
+        for i in range(100):
+            if os.path.exists(self.path):
+                break
+            time.sleep(0.05)
+
+    def tearDown(self):
+        self.child.terminate(force=True)
+        self.child.logfile.close()
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+
+    def connect(self):
+        conn = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        conn.settimeout(10)
+        conn.connect(self.path)
+        return conn
+
+    def request(self, conn, line, env=(), envc=None, fds=(), flags=1,
+                cwd=None):
+        data = b''.join(s.encode('utf-8') + b'\0'
+                        for s in [cwd or os.getcwd(), line, *env])
+        header = struct.pack('=IIi', len(data), flags,
+                             len(env) if envc is None else envc)
+        socket.send_fds(conn, [header], list(fds))
+        conn.sendall(data)
+
+    def reply(self, conn):
+        header = b''
+        while len(header) < 8:
+            try:
+                chunk = conn.recv(8 - len(header))
+            except ConnectionResetError:
+                chunk = b''
+            if not chunk:
+                return None
+            header += chunk
+        status, size = struct.unpack('=iI', header)
+        output = b''
+        while len(output) < size:
+            output += conn.recv(size - len(output))
+        return status, output.decode('utf-8')
+
+    def test_malformed_request(self):
+        # envc way beyond what fits in the strings
+        with self.connect() as conn:
+            self.request(conn, 'echo a', envc=0x7fffffff)
+            self.assertIsNone(self.reply(conn))
+        with self.connect() as conn:
+            self.request(conn, 'echo ok')
+            self.assertEqual(self.reply(conn), (0, 'ok\n'))
+
+    def test_requests(self):
+        with self.connect() as conn:
+            self.request(conn, 'false')
+            self.assertEqual(self.reply(conn), (1, ''))
+
+            # assignments apply to a single command
+            self.request(conn, 'printenv X', env=['X=1'])
+            self.assertEqual(self.reply(conn), (0, '1\n'))
+            self.request(conn, 'printenv X')
+            self.assertEqual(self.reply(conn), (1, ''))
+
+            with TemporaryDirectory() as d:
+                self.request(conn, 'pwd', cwd=d)
+                self.assertEqual(self.reply(conn), (0, d + '\n'))
+
+            # standard streams passed along, nothing captured
+            inr, inw = os.pipe()
+            outr, outw = os.pipe()
+            os.write(inw, b'piped\n')
+            os.close(inw)
+            self.request(conn, 'cat', fds=[inr, outw], flags=0)
+            os.close(inr)
+            os.close(outw)
+            self.assertEqual(self.reply(conn), (0, ''))
+            with os.fdopen(outr) as f:
+                self.assertEqual(f.read(), 'piped\n')
+
+
 if __name__ == '__main__':
     os.environ['PATH'] = '/usr/bin:/bin'
     os.environ['LC_ALL'] = 'C'
@@ -6,8 +6,18 @@
 #define DEBUG 0
 #include "shell.h"
 
+#include <getopt.h>
+#include <sys/ioctl.h>
+
 sigset_t sigchld_mask;
 
+/* Set by "shell -c", whose foreground command is the last thing it does. */
+static bool oneshot = false;
+
+/* Commands are read from the terminal, rather than given with -c or sent to
+ * the command server. */
+static bool interactive = false;
+
 static void sigint_handler(int sig) {
   /* No-op handler, we just need break read() call with EINTR. */
   (void)sig;
@@ -22,63 +32,488 @@ static void MaybeClose(int *fdp) {
   *fdp = -1;
 }
 
-/* Consume all tokens related to redirection operators.
- * Put opened file descriptors into inputp & output respectively. */
-static int do_redir(token_t *token, int ntokens, int *inputp, int *outputp) {
-  token_t mode = NULL; /* T_INPUT, T_OUTPUT or NULL */
-  int n = 0;           /* number of tokens after redirections are removed */
+static void mkpipe(int *readp, int *writep) {
+  int fds[2];
+  Pipe(fds);
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  *readp = fds[0];
+  *writep = fds[1];
+}
+
+/* Descriptor to read here-document or here-string `text` from. Text that
+ * fits in a pipe is written there at once. Longer text goes to a memory file
+ * sealed against changes. Either way no file system is involved. */
+static int heredoc(const char *text, bool newline) {
+  struct iovec iov[2] = {{.iov_base = (char *)text, .iov_len = strlen(text)},
+                         {.iov_base = "\n", .iov_len = newline}};
+  size_t len = iov[0].iov_len + iov[1].iov_len;
+  int fd, wfd;
+
+  if (len <= PIPE_BUF) {
+    mkpipe(&fd, &wfd);
+    Writev(wfd, iov, 2);
+    Close(wfd);
+    return fd;
+  }
+
+  fd = Memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  Writev(fd, iov, 2);
+  fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW |
+                           F_SEAL_WRITE);
+  Lseek(fd, 0, SEEK_SET);
+  return fd;
+}
+
+/* Descriptor number `s`, or -1 if it's not one. */
+static int fdnum(const char *s) {
+  if (*s == '\0' || strspn(s, "0123456789") != strlen(s) || strlen(s) > 4)
+    return -1;
+  return atoi(s);
+}
+
+/* Consume all tokens related to redirection operators and record them in
+ * descriptor table `r`. Returns the number of remaining tokens, or -1 if a
+ * redirection failed, in which case an error message has been printed. */
+int do_redir(token_t *token, int ntokens, redir_t *r) {
+  int n = 0;      /* number of tokens after redirections are removed */
+  bool ok = true; /* all redirections have been made */
 
   for (int i = 0; i < ntokens; i++) {
     /* TODO: Handle tokens and open files as requested. */
 #ifdef STUDENT
+    // pomijamy tokeny zuzyte wczesniej
+    if (token[i] == T_NULL)
+      continue;
 
-    // if ze wzgledu na flage -Werror
-    if (mode)
-      ;
-
-    // znajdujemy token przekierowania wejscia
-    if (token[i] == T_INPUT) {
-      // zamykamy aktualne wejscie
-      MaybeClose(inputp);
-      // otwieramy nowe na powstawie kolejnego tokena
-      *inputp = Open(token[i + 1], O_RDONLY, S_IRWXU);
-      // zerujemy wykorzystane tokeny
-      token[i] = T_NULL;
-      token[i + 1] = T_NULL;
-      // znajdujemy token przekierowania wyjscia
-    } else if (token[i] == T_OUTPUT) {
-      // zamykamy aktualne wyjscie
-      MaybeClose(outputp);
-      // otwieramy nowe wyjscie na podstawie kolejnego tokane
-      *outputp = Open(token[i + 1], O_WRONLY | O_CREAT | O_APPEND, S_IRWXU);
-      // zerujemy wykorzystane tokeny
-      token[i] = T_NULL;
-      token[i + 1] = T_NULL;
-      // pomijamy wykorzystane tokeny
-    } else if (token[i] == T_NULL) {
+    // przepisujemy na poczatek tablicy tokeny niebedace przekierowaniami
+    token_t op = token[i];
+    if (op != T_IONUM && op != T_INPUT && op != T_OUTPUT && op != T_APPEND &&
+        op != T_HEREDOC && op != T_HERESTR && op != T_DUPIN &&
+        op != T_DUPOUT && op != T_RDWR) {
+      token[n++] = op;
       continue;
-      // zliczamy niewykorzystane tokeny
+    }
+
+    // opcjonalny numer deskryptora poprzedza operator, np. "2>"
+    int fd = -1;
+    if (op == T_IONUM) {
+      // numer mogl powstac z rozwiniecia zmiennej - jezeli nie jest liczba,
+      // to jest zwyklym slowem, jak w "echo $x>plik"
+      if (string_p(token[++i]) && (fd = fdnum(token[i])) < 0)
+        token[n++] = token[i];
+      if (!string_p(token[i]))
+        i--;
+      op = token[++i];
+    }
+
+    // operator musi byc zakonczony slowem
+    if (i + 1 >= ntokens || !string_p(token[i + 1])) {
+      msg("syntax error: expected a word after redirection\n");
+      ok = false;
+      break;
+    }
+    char *word = token[++i];
+
+    // domyslnie przekierowujemy wejscie albo wyjscie w zaleznosci od operatora
+    bool in = op == T_INPUT || op == T_RDWR || op == T_DUPIN ||
+              op == T_HEREDOC || op == T_HERESTR;
+    if (fd < 0)
+      fd = in ? STDIN_FILENO : STDOUT_FILENO;
+
+    if (op == T_HEREDOC || op == T_HERESTR) {
+      // wejsciem jest tresc dokumentu, ktora eval wstawil w miejsce
+      // ogranicznika, lub napis zakonczony znakiem nowej linii
+      redir_open(r, fd, heredoc(word, op == T_HERESTR));
+    } else if (op == T_DUPIN || op == T_DUPOUT) {
+      // "N>&-" zamyka deskryptor, a "N>&M" czyni go kopia deskryptora M
+      if (!strcmp(word, "-")) {
+        redir_set(r, fd, -1, false);
+        continue;
+      }
+      bool cloexec;
+      int src = fdnum(word);
+      if (src >= 0)
+        src = redir_source(r, src, &cloexec);
+      if (src < 0) {
+        msg("%s: %s\n", word, strerror(EBADF));
+        ok = false;
+        break;
+      }
+      redir_set(r, fd, src, cloexec);
     } else {
-      n++;
+      // otwieramy plik w trybie zaleznym od operatora
+      int flags = op == T_INPUT    ? O_RDONLY
+                  : op == T_RDWR   ? O_RDWR | O_CREAT
+                  : op == T_APPEND ? O_WRONLY | O_CREAT | O_APPEND
+                                   : O_WRONLY | O_CREAT | O_TRUNC;
+      int file = open(word, flags | O_CLOEXEC, DEFFILEMODE);
+      if (file < 0) {
+        msg("%s: %s\n", word, strerror(errno));
+        ok = false;
+        break;
+      }
+      redir_open(r, fd, file);
     }
 #endif /* !STUDENT */
   }
 
   token[n] = NULL;
+  return ok ? n : -1;
+}
+
+/* Space taken by strings and pointers of an argument vector in execve. */
+static size_t argsize(char **argv) {
+  size_t size = sizeof(char *);
+  for (; *argv; argv++)
+    size += strlen(*argv) + 1 + sizeof(char *);
+  return size;
+}
+
+/* 'batch [-P n] command [-options...] args...' runs the command as many
+ * times as needed to pass all the arguments without exceeding ARG_MAX, much
+ * like xargs does, but without any helper process. Options right after the
+ * command are passed to each invocation. Invocations run one after another,
+ * or with -P at most n at a time (all at once if n is 0, or if the batch runs
+ * in the background). All of them make up a single job. */
+static int do_batch(token_t *token, int ntokens, redir_t *r, bool bg) {
+  int parallel = 1;
+
+  if (ntokens >= 3 && !strcmp(token[1], "-P")) {
+    parallel = atoi(token[2]);
+    token += 2, ntokens -= 2;
+  }
+  token++, ntokens--;
+
+  if (ntokens == 0 || parallel < 0) {
+    msg("batch: usage: batch [-P n] command [-options...] args...\n");
+    return 2;
+  }
+  if (parallel == 0 || bg)
+    parallel = INT_MAX;
+
+  int nfixed = 1;
+  while (nfixed < ntokens && token[nfixed][0] == '-')
+    nfixed++;
+
+  /* Leave some room as xargs does, since execve itself needs a bit. */
+  char *label[nfixed + 2];
+  char **argv = malloc(sizeof(char *) * (ntokens + 1));
+  long limit = sysconf(_SC_ARG_MAX) - argsize(getenvp()) - 2048;
+
+  memcpy(argv, token, sizeof(char *) * nfixed);
+  argv[nfixed] = NULL;
+  memcpy(label, token, sizeof(char *) * nfixed);
+  label[nfixed] = "...";
+  label[nfixed + 1] = NULL;
+  limit -= argsize(argv);
+
+  fdop_t op[2 * r->n + 1];
+  int nop = fdmove_plan(r->move, r->n, op);
+
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  int job = -1, exitcode = 0, next = nfixed;
+  pid_t pgid = 0;
+
+  do {
+    if (job >= 0 && (pgid = batchwait(job, parallel, &mask)) < 0)
+      break;
+
+    /* Each invocation takes at least one argument, even if it's too long. */
+    int n = nfixed;
+    for (long size = 0; next < ntokens; n++, next++) {
+      size += strlen(token[next]) + 1 + sizeof(char *);
+      if (n > nfixed && size > limit)
+        break;
+      argv[n] = token[next];
+    }
+    argv[n] = NULL;
+
+    spawn_start = stats_clock();
+    pid_t pid = Fork();
+    if (pid)
+      stats_record(S_FORK, spawn_start);
+    setpgid(pid, pgid);
+
+    if (!pid) {
+      if (!bg)
+        setfgpgrp(pgid ? pgid : getpid());
+      Signal(SIGTSTP, SIG_DFL);
+      Signal(SIGTTIN, SIG_DFL);
+      Signal(SIGTTOU, SIG_DFL);
+      if (fdmove_apply(op, nop) < 0)
+        unix_error("Redirection error");
+      Sigprocmask(SIG_SETMASK, &mask, NULL);
+      external_command(argv);
+    }
+
+    if (job < 0) {
+      job = addjob(pid, bg);
+      batchjob(job);
+    }
+    addproc(job, pid, label);
+    if (!bg)
+      setfgpgrp(pgid ? pgid : pid);
+  } while (next < ntokens);
+
+  if (next < ntokens)
+    msg("batch: %d arguments not processed\n", ntokens - next);
+
+  free(argv);
+
+  if (!bg)
+    exitcode = monitorjob(&mask);
+  else
+    msg("[%d] running '%s'\n", job, jobcmd(job));
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  return exitcode;
+}
+
+/* 'coproc NAME command args...' starts the command in the background with
+ * its standard input and output connected to a socket, whose other end `sock`
+ * is kept by the shell like a descriptor opened by "exec". Its number is
+ * stored in variable NAME and the pid in NAME_PID, so that later commands can
+ * talk to the coprocess, e.g. 'echo 2+2 >&$NAME'. Closing the socket with
+ * 'exec N>&-' gives the coprocess end of file. */
+static int do_coproc(token_t *token, int ntokens, redir_t *r, int *sock) {
+  if (ntokens < 3 || !name_p(token[1])) {
+    msg("coproc: usage: coproc NAME command [args...]\n");
+    Close(sock[0]);
+    Close(sock[1]);
+    return 2;
+  }
+  const char *name = token[1];
+  token += 2, ntokens -= 2;
+
+  fdop_t op[2 * r->n + 1];
+  int nop = fdmove_plan(r->move, r->n, op);
+
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  spawn_start = stats_clock();
+  pid_t pid = spawn(token, 0, false, r);
+  if (pid < 0)
+    pid = Fork();
+  if (pid)
+    stats_record(S_FORK, spawn_start);
+  setpgid(pid, pid);
+
+  if (!pid) {
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+    if (fdmove_apply(op, nop) < 0)
+      unix_error("Redirection error");
+    Sigprocmask(SIG_SETMASK, &mask, NULL);
+    int exitcode = builtin_command(token);
+    if (exitcode >= 0)
+      exit(exitcode);
+    external_command(token);
+  }
+
+  int job = addjob(pid, BG);
+  addproc(job, pid, token);
+  Close(sock[1]);
+  redir_adopt(sock[0]);
+
+  char value[16];
+  char *pidvar = malloc(strlen(name) + sizeof("_PID"));
+  snprintf(value, sizeof(value), "%d", sock[0]);
+  setvar(name, value, false);
+  snprintf(value, sizeof(value), "%d", pid);
+  strcat(strcpy(pidvar, name), "_PID");
+  setvar(pidvar, value, false);
+  free(pidvar);
+
+  msg("[%d] running '%s'\n", job, jobcmd(job));
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  return 0;
+}
+
+static int evaltokens(token_t *token, int ntokens);
+static bool is_pipeline(token_t *token, int ntokens);
+
+/* Process substitution "<(cmd)" or ">(cmd)" of a command being started. The
+ * command opens `outer` end of a pipe as /dev/fd/N, while `cmd` has the other
+ * end as its standard output or input respectively. */
+typedef struct psub {
+  const char *word; /* the substitution as written */
+  int outer;        /* pipe end given to the command */
+  int inner;        /* pipe end given to `cmd` */
+} psub_t;
+
+/* Create pipes for process substitutions among words of a command. Both ends
+ * are close-on-exec, so that no other process keeps them by accident.
+ * Returns the number of substitutions. */
+static int psub_open(token_t *token, int ntokens, psub_t *psub) {
+  int n = 0;
+  for (int i = 0; i < ntokens; i++) {
+    if (!string_p(token[i]) || !procsubst_p(token[i]))
+      continue;
+    psub_t *ps = &psub[n++];
+    ps->word = token[i];
+    if (token[i][0] == '<')
+      mkpipe(&ps->outer, &ps->inner);
+    else
+      mkpipe(&ps->inner, &ps->outer);
+  }
   return n;
 }
 
+/* Called by the process of a command. Substitutions are replaced with paths
+ * of pipe ends, which are made to survive execve. The shell keeps words as
+ * they were, so they show up in job's command. */
+static void psub_apply(token_t *token, int ntokens, psub_t *psub, int n) {
+  for (int i = 0, k = 0; i < ntokens && k < n; i++) {
+    if (token[i] != psub[k].word)
+      continue;
+    token[i] = malloc(32);
+    snprintf(token[i], 32, "/dev/fd/%d", psub[k].outer);
+    fcntl(psub[k].outer, F_SETFD, 0);
+    Close(psub[k].inner);
+    k++;
+  }
+}
+
+/* A simple command replaces the process, so that it stays in the job's
+ * process group. A pipeline becomes a job of this subshell, as it does with
+ * command substitution. */
+static noreturn void psub_exec(const char *word, sigset_t *mask) {
+  int ntokens;
+  token_t *token = tokenize(strndup(word + 2, strlen(word) - 3), &ntokens);
+
+  Sigprocmask(SIG_SETMASK, mask, NULL);
+  if (is_pipeline(token, ntokens)) {
+    forgetjobs();
+    exit(evaltokens(token, ntokens));
+  }
+
+  Signal(SIGINT, SIG_DFL);
+  Signal(SIGTSTP, SIG_DFL);
+  Signal(SIGTTIN, SIG_DFL);
+  Signal(SIGTTOU, SIG_DFL);
+
+  redir_t r;
+  redir_init(&r, -1, -1);
+  if ((ntokens = do_redir(token, ntokens, &r)) < 0)
+    exit(EXIT_FAILURE);
+  if (ntokens == 0)
+    exit(0);
+  fdop_t op[2 * r.n + 1];
+  if (fdmove_apply(op, fdmove_plan(r.move, r.n, op)) < 0)
+    unix_error("Redirection error");
+
+  int exitcode = builtin_command(token);
+  if (exitcode >= 0)
+    exit(exitcode);
+  external_command(token);
+}
+
+/* Start commands of process substitutions in process group `pgid`, once the
+ * command that uses them is running. They're helpers of job `job`, so the
+ * job's exit status is still the command's one. */
+static void psub_start(int job, pid_t pgid, sigset_t *mask, psub_t *psub,
+                       int n) {
+  for (int k = 0; k < n; k++) {
+    pid_t pid = Fork();
+    if (pid == 0) {
+      setpgid(0, pgid);
+      Dup2(psub[k].inner,
+           psub[k].word[0] == '<' ? STDOUT_FILENO : STDIN_FILENO);
+      for (int i = k; i < n; i++) {
+        Close(psub[i].inner);
+        Close(psub[i].outer);
+      }
+      psub_exec(psub[k].word, mask);
+    }
+    setpgid(pid, pgid);
+    addproc(job, pid, NULL);
+    Close(psub[k].inner);
+    Close(psub[k].outer);
+  }
+}
+
 /* Execute internal command within shell's process or execute external command
  * in a subprocess. External command can be run in the background. */
 static int do_job(token_t *token, int ntokens, bool bg) {
-  int input = -1, output = -1;
+  redir_t r;
   int exitcode = 0;
 
-  ntokens = do_redir(token, ntokens, &input, &output);
+  /* Redirections of a coprocess may refer to its socket, e.g. with "2>&1". */
+  int sock[2] = {-1, -1};
+  if (ntokens > 0 && string_p(token[0]) && !strcmp(token[0], "coproc"))
+    Socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sock);
+
+  uint64_t t = stats_clock();
+  redir_init(&r, sock[1], sock[1]);
+  ntokens = do_redir(token, ntokens, &r);
+  stats_record(S_REDIR, t);
+
+  if (ntokens < 0) {
+    MaybeClose(&sock[0]);
+    MaybeClose(&sock[1]);
+    redir_done(&r);
+    return 1;
+  }
 
-  if (!bg) {
-    if ((exitcode = builtin_command(token)) >= 0)
+  if (sock[0] >= 0) {
+    exitcode = do_coproc(token, ntokens, &r, sock);
+    redir_done(&r);
+    return exitcode;
+  }
+
+  /* "exec" with redirections only changes descriptors of the shell. */
+  if (ntokens > 0 && !strcmp(token[0], "exec")) {
+    if (ntokens > 1) {
+      msg("exec: usage: exec [redirections...]\n");
+      exitcode = 2;
+    } else {
+      exitcode = redir_persist(&r) < 0;
+    }
+    redir_done(&r);
+    return exitcode;
+  }
+
+  if (ntokens > 0 && !strcmp(token[0], "batch")) {
+    exitcode = do_batch(token, ntokens, &r, bg);
+    redir_done(&r);
+    return exitcode;
+  }
+
+  psub_t psub[ntokens + 1];
+  int npsub = psub_open(token, ntokens, psub);
+
+  if (!bg && npsub == 0) {
+    /* Builtins run by the shell itself write to redirected output. Other
+     * redirections don't apply to them. */
+    builtin_output(redir_source(&r, STDOUT_FILENO, NULL), NULL);
+    exitcode = builtin_command(token);
+    builtin_output(STDOUT_FILENO, NULL);
+    if (exitcode >= 0) {
+      redir_done(&r);
       return exitcode;
+    }
+  }
+
+  /* Descriptors are arranged by the new process as planned here. */
+  fdop_t op[2 * r.n + 1];
+  int nop = fdmove_plan(r.move, r.n, op);
+
+  /* The last command of "shell -c" replaces the shell, saving a fork. */
+  if (oneshot && !bg && npsub == 0) {
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+    if (fdmove_apply(op, nop) < 0)
+      unix_error("Redirection error");
+    spawn_start = stats_clock();
+    external_command(token);
   }
 
   sigset_t mask;
@@ -86,8 +521,15 @@ static int do_job(token_t *token, int ntokens, bool bg) {
 
   /* TODO: Start a subprocess, create a job and monitor it. */
 #ifdef STUDENT
-  // tworzymy nowy proces
-  pid_t pid = Fork();
+  // tworzymy nowy proces i mierzymy czas jego tworzenia - jezeli dziala
+  // serwer procesow, to on tworzy proces, a w p.p. robimy to sami (takze gdy
+  // polecenie potrzebuje potokow podstawien procesow)
+  spawn_start = stats_clock();
+  pid_t pid = npsub ? -1 : spawn(token, 0, !bg, &r);
+  if (pid < 0)
+    pid = Fork();
+  if (pid)
+    stats_record(S_FORK, spawn_start);
 
   // z poziomu procesu i shell-a usawiamy nowy proces jako lidera swojej wlasnej
   // grupy procesow
@@ -105,16 +547,13 @@ static int do_job(token_t *token, int ntokens, bool bg) {
     Signal(SIGTTIN, SIG_DFL);
     Signal(SIGTTOU, SIG_DFL);
 
-    // jezeli do_redir zarejestrowal przekierowanie strumieni wejscia/wyjscia
-    // kopiujemy deskryptory na odpowiednie miejsca i zamykamy te wykorzystane
-    if (input != -1) {
-      dup2(input, STDIN_FILENO);
-      MaybeClose(&input);
-    }
-    if (output != -1) {
-      dup2(output, STDOUT_FILENO);
-      MaybeClose(&output);
-    }
+    // ustawiamy deskryptory zgodnie z planem wyznaczonym przez shell-a na
+    // podstawie przekierowan zarejestrowanych przez do_redir
+    if (fdmove_apply(op, nop) < 0)
+      unix_error("Redirection error");
+
+    // podstawienia procesow zamieniamy na sciezki /dev/fd/N
+    psub_apply(token, ntokens, psub, npsub);
 
     // przed wykonaniem polecenia przywracamy standarowa maske sygnalow
     // zapobiegajac blokady sygnalu SIGCHLD
@@ -127,10 +566,11 @@ static int do_job(token_t *token, int ntokens, bool bg) {
   int j;
   // tworzymy nowe zadanie i dodajemy do niego nowy proces
   addproc(j = addjob(pid, bg), pid, token);
+  // oraz procesy podstawien w jego grupie
+  psub_start(j, pid, &mask, psub, npsub);
 
   // zamykamy niepotrzebne deskryptory
-  MaybeClose(&input);
-  MaybeClose(&output);
+  redir_done(&r);
 
   // jezeli zadanie pierwszoplanowe oddajemy terminal grupie nowopowstalego
   // procesu i monitorujemy zadanie
@@ -150,14 +590,29 @@ static int do_job(token_t *token, int ntokens, bool bg) {
 /* Start internal or external command in a subprocess that belongs to pipeline.
  * All subprocesses in pipeline must belong to the same process group. */
 static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
-                      token_t *token, int ntokens, bool bg) {
-  ntokens = do_redir(token, ntokens, &input, &output);
+                      token_t *token, int ntokens, bool bg, psub_t *psub,
+                      int npsub) {
+  redir_t r;
+  uint64_t t = stats_clock();
+  redir_init(&r, input, output);
+  ntokens = do_redir(token, ntokens, &r);
+  stats_record(S_REDIR, t);
 
   if (ntokens == 0)
     app_error("ERROR: Command line is not well formed!");
 
+  /* A stage whose redirections failed is still started, so that the pipeline
+   * keeps its shape, but it only exits with failure. */
+  fdop_t op[2 * r.n + 1];
+  int nop = ntokens > 0 ? fdmove_plan(r.move, r.n, op) : 0;
+
   /* TODO: Start a subprocess and make sure it's moved to a process group. */
-  pid_t pid = Fork();
+  spawn_start = stats_clock();
+  pid_t pid = npsub || ntokens < 0 ? -1 : spawn(token, pgid, !bg, &r);
+  if (pid < 0)
+    pid = Fork();
+  if (pid)
+    stats_record(S_FORK, spawn_start);
 #ifdef STUDENT
   // jezeli pgid zadania nie zostal jeszcze ustalony proces staje sie liderem
   // grupy procesow zdania, w p.p. ustawiamy grupe procesu na istniejaca
@@ -165,6 +620,10 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
 
   // jezeli nowy proces
   if (!pid) {
+    // nie udalo sie wykonac przekierowan, wiec konczymy z bledem
+    if (ntokens < 0)
+      exit(EXIT_FAILURE);
+
     // jezeli zadanie pierszoplanowe oddajemy terminal grupie tego zadania
     if (!bg) {
       setfgpgrp((!pgid) ? getpid() : pgid);
@@ -174,25 +633,23 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
     Signal(SIGTTIN, SIG_DFL);
     Signal(SIGTTOU, SIG_DFL);
 
-    // jezeli do_redir zarejestrowal przekierowanie strumieni wejscia/wyjscia
-    // kopiujemy deskryptory na odpowiednie miejsca i zamykamy te wykorzystane
-    if (input != -1) {
-      dup2(input, STDIN_FILENO);
-      MaybeClose(&input);
-    }
-    if (output != -1) {
-      dup2(output, STDOUT_FILENO);
-      MaybeClose(&output);
-    }
+    // ustawiamy deskryptory zgodnie z planem wyznaczonym przez shell-a na
+    // podstawie przekierowan zarejestrowanych przez do_redir
+    if (fdmove_apply(op, nop) < 0)
+      unix_error("Redirection error");
+
+    // podstawienia procesow zamieniamy na sciezki /dev/fd/N
+    psub_apply(token, ntokens, psub, npsub);
 
     // przed wykonaniem polecenia przywracamy standarowa maske sygnalow
     // zapobiegajac blokady sygnalu SIGCHLD
     Sigprocmask(SIG_SETMASK, mask, NULL);
 
-    // sprawdzamy czy polecenie nie jest wbudowana komenda
+    // sprawdzamy czy polecenie nie jest wbudowana komenda - jesli tak, to
+    // proces potomny konczy sie zaraz po jej wykonaniu
     int exitcode = 0;
     if ((exitcode = builtin_command(token)) >= 0) {
-      return exitcode;
+      exit(exitcode);
     }
 
     // wykonujemy polecenie
@@ -208,16 +665,27 @@ static pid_t do_stage(pid_t pgid, sigset_t *mask, int input, int output,
   }
 #endif /* !STUDENT */
 
+  redir_done(&r);
   return pid;
 }
 
-static void mkpipe(int *readp, int *writep) {
-  int fds[2];
-  Pipe(fds);
-  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
-  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
-  *readp = fds[0];
-  *writep = fds[1];
+/* Start helper process of fan-out operator in process group `pgid`. It reads
+ * `input` and writes to `output` pipes, whose read ends `unused` it closes. */
+static pid_t do_fanout(pid_t pgid, sigset_t *mask, int input, int *output,
+                       int *unused, int n) {
+  pid_t pid = Fork();
+  if (pid == 0) {
+    for (int i = 0; i < n; i++)
+      Close(unused[i]);
+    Signal(SIGINT, SIG_DFL);
+    Signal(SIGTSTP, SIG_DFL);
+    Signal(SIGTTIN, SIG_DFL);
+    Signal(SIGTTOU, SIG_DFL);
+    Sigprocmask(SIG_SETMASK, mask, NULL);
+    fanout(input, output, n);
+  }
+  setpgid(pid, pgid);
+  return pid;
 }
 
 /* Pipeline execution creates a multiprocess job. Both internal and external
@@ -241,12 +709,19 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
   int start_token = 0;
   // koniec oblugiwanego polecenia w pipeline
   int end_token = 0;
+  // wejscia odbiorcow rozgalezienia "|>" i liczba juz uruchomionych
+  int *fan_input = NULL;
+  int fan_count = 0, fan_next = 0;
+  // podstawienia procesow w obslugiwanym poleceniu
+  psub_t psub[ntokens];
+  int npsub;
 
   // dopoki poczatek polecenia nie znajdzie sie poza tablica tokenow
   while (start_token < ntokens) {
 
     // szukamy drugiego konca polecenia
-    while (token[end_token] != T_PIPE && end_token < ntokens) {
+    while (end_token < ntokens && token[end_token] != T_PIPE &&
+           token[end_token] != T_FANOUT) {
       end_token++;
     }
 
@@ -256,8 +731,16 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
       break;
     }
 
-    // jezeli nie jest to pierwsze polecenie obslugiewane w pipeline
-    if (pgid) {
+    // polecenie przed "|>" jest zrodlem danych rozgalezienia, chyba ze samo
+    // jest jednym z odbiorcow poprzedniego zrodla
+    bool producer = token[end_token] == T_FANOUT && fan_next == fan_count;
+
+    if (token[end_token] == T_FANOUT && !producer) {
+      // odbiorca (poza ostatnim) pisze na standardowe wyjscie, a nastepny
+      // czyta z kolejnego wyjscia rozgalezienia
+      next_input = fan_input[fan_next++];
+    } else if (pgid) {
+      // jezeli nie jest to pierwsze polecenie obslugiewane w pipeline
       // tworzymy pipe-a
       mkpipe(&next_input, &output);
     }
@@ -267,8 +750,9 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
     token[end_token] = T_NULL;
 
     // wykonujemy obslugiwane polecenie
+    npsub = psub_open(token + start_token, end_token - start_token, psub);
     pid = do_stage(pgid, &mask, input, output, token + start_token,
-                   end_token - start_token + 1, bg);
+                   end_token - start_token + 1, bg, psub, npsub);
 
     // jezeli pgid nie zostal jeszcze ustalony (obslugijemy pierwsze polecenie)
     // ustawiamy go i tworzymy nowe zadanie
@@ -277,8 +761,9 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
       job = addjob(pgid, bg);
     }
 
-    // dodajemy proces do zadania
+    // dodajemy proces do zadania, a za nim procesy podstawien
     addproc(job, pid, token + start_token);
+    psub_start(job, pgid, &mask, psub, npsub);
 
     // zamykamy niepotrzebne deskryptory
     MaybeClose(&input);
@@ -287,19 +772,45 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
     // ustawimy strumien wejscia dla przyszlego polecenie w pipeline
     input = next_input;
 
+    // uruchamiamy proces rozgalezienia z wyjsciem do kazdego z odbiorcow,
+    // ktorych jest tylu, ile "|>" przed najblizszym "|"
+    if (producer) {
+      fan_count = 1;
+      for (int i = end_token + 1; i < ntokens && token[i] != T_PIPE; i++)
+        if (token[i] == T_FANOUT)
+          fan_count++;
+
+      fan_input = realloc(fan_input, sizeof(int) * fan_count);
+      int fan_output[fan_count];
+      for (int i = 0; i < fan_count; i++)
+        mkpipe(&fan_input[i], &fan_output[i]);
+
+      pid = do_fanout(pgid, &mask, input, fan_output, fan_input, fan_count);
+      addproc(job, pid, NULL);
+
+      MaybeClose(&input);
+      for (int i = 0; i < fan_count; i++)
+        Close(fan_output[i]);
+      input = fan_input[0];
+      fan_next = 1;
+    }
+
     // przesuwamy start na pierwszy token po "|"
     start_token = end_token + 1;
   }
   // oblugujemy ostatnie polecenie w pipeline
 
   // wykonujemy obslugiwane polecenie
+  npsub = psub_open(token + start_token, ntokens - start_token, psub);
   pid = do_stage(pgid, &mask, input, -1, token + start_token,
-                 ntokens - start_token + 1, bg);
-  // dodajemy proces do zadania
+                 ntokens - start_token + 1, bg, psub, npsub);
+  // dodajemy proces do zadania, a za nim procesy podstawien
   addproc(job, pid, token + start_token);
+  psub_start(job, pgid, &mask, psub, npsub);
   // zamykamy niepotrzebne deskryptory
   MaybeClose(&input);
   MaybeClose(&output);
+  free(fan_input);
 
   // jezeli zadanie pierwszoplanowe monitorujemy jego stan
   if (!bg) {
@@ -315,72 +826,405 @@ static int do_pipeline(token_t *token, int ntokens, bool bg) {
 
 static bool is_pipeline(token_t *token, int ntokens) {
   for (int i = 0; i < ntokens; i++)
-    if (token[i] == T_PIPE)
+    if (token[i] == T_PIPE || token[i] == T_FANOUT)
       return true;
   return false;
 }
 
-static void eval(char *cmdline) {
+static int evaltokens(token_t *token, int ntokens) {
+  int exitcode = 0;
   bool bg = false;
-  int ntokens;
-  token_t *token = tokenize(cmdline, &ntokens);
 
   if (ntokens > 0 && token[ntokens - 1] == T_BGJOB) {
     token[--ntokens] = NULL;
     bg = true;
   }
 
+  /* Lists of commands are not supported. A separator must not get to a
+   * command, as builtins would take it for a word. */
+  for (int i = 0; i < ntokens; i++) {
+    if (token[i] == T_AND || token[i] == T_OR || token[i] == T_COLON ||
+        token[i] == T_BGJOB) {
+      msg("syntax error: lists of commands are not supported\n");
+      return 2;
+    }
+  }
+
   if (ntokens > 0) {
     if (is_pipeline(token, ntokens)) {
-      do_pipeline(token, ntokens, bg);
+      exitcode = do_pipeline(token, ntokens, bg);
     } else {
-      do_job(token, ntokens, bg);
+      exitcode = do_job(token, ntokens, bg);
     }
   }
 
+  return exitcode;
+}
+
+#ifndef READLINE
+static char *readline(const char *prompt);
+#endif
+
+/* Next line of a here-document body. Commands given with -c or sent to the
+ * server carry bodies in their text, on lines following the command line.
+ * Only an interactive shell reads them from the terminal. */
+static char *bodyline(char **textp, bool intext) {
+  if (intext)
+    return *textp ? strdup(strsep(textp, "\n")) : NULL;
+  return readline("> ");
+}
+
+/* Read bodies of here-documents of a command line and put them in place of
+ * their delimiters. Variables are expanded in each line. Bodies are taken
+ * from `text`, the rest of command text, unless the shell is interactive and
+ * there's none. Memory that holds them until the command is done is returned
+ * through `bodiesp`. Returns false on a syntax error. */
+static bool heredocs(token_t *token, int ntokens, char *text,
+                     char **bodiesp) {
+  outbuf_t buf = {};
+  size_t offset[ntokens + 1];
+  int n = 0;
+  bool intext = text || !interactive;
+
+  for (int i = 0; i + 1 < ntokens; i++) {
+    if (token[i] != T_HEREDOC || !string_p(token[i + 1]))
+      continue;
+
+    const char *delim = token[i + 1];
+    char *line;
+    if (n == 0 && intext && text == NULL) {
+      msg("here-document without body (wanted '%s')\n", delim);
+      free(buf.data);
+      return false;
+    }
+    offset[n++] = buf.len;
+    while ((line = bodyline(&text, intext)) && strcmp(line, delim)) {
+      char *body = malloc(expand(NULL, line) + 1);
+      outbuf_append(&buf, body, expand(body, line));
+      outbuf_append(&buf, "\n", 1);
+      free(body);
+      free(line);
+    }
+    if (line == NULL)
+      msg("here-document delimited by end-of-file (wanted '%s')\n", delim);
+    free(line);
+    outbuf_append(&buf, "", 1);
+  }
+
+  /* Lines are not commands of their own, as lists are not supported. */
+  if (text && text[strspn(text, " \t\n")]) {
+    msg("syntax error: lists of commands are not supported\n");
+    free(buf.data);
+    return false;
+  }
+
+  for (int i = 0, k = 0; k < n; i++)
+    if (token[i] == T_HEREDOC && string_p(token[i + 1]))
+      token[i + 1] = buf.data + offset[k++];
+  *bodiesp = buf.data;
+  return true;
+}
+
+static int eval(char *cmdline) {
+  /* Anything past the first line are here-document bodies. */
+  char *text = strchr(cmdline, '\n');
+  if (text)
+    *text++ = '\0';
+
+  int ntokens;
+  uint64_t t = stats_clock();
+  token_t *token = tokenize(cmdline, &ntokens);
+  stats_record(S_TOKENIZE, t);
+
+  char *bodies = NULL;
+  int exitcode = 2;
+  if (heredocs(token, ntokens, text, &bodies))
+    exitcode = evaltokens(token, ntokens);
+
+  free(bodies);
   free(token);
+  return exitcode;
+}
+
+/* Is it a pipeline of builtins that don't change state of the shell? */
+static bool pure_pipeline_p(token_t *token, int ntokens) {
+  for (int i = 0; i < ntokens; i++) {
+    if (i > 0 && token[i - 1] != T_PIPE)
+      continue;
+    if (!pure_builtin_p(&token[i]))
+      return false;
+  }
+
+  for (int i = 0; i < ntokens; i++)
+    if (string_p(token[i]) ? procsubst_p(token[i]) : token[i] != T_PIPE)
+      return false;
+  return true;
 }
 
+/* Evaluate command substitution and return its output with trailing
+ * newlines removed. A pipeline of pure builtins runs within the shell and
+ * writes straight into memory, since none of them reads its input. Any other
+ * command runs in a subshell, whose output is read from a pipe. */
+char *cmdsubst(char *cmdline) {
+  outbuf_t buf = {};
+  int ntokens;
+  token_t *token = tokenize(cmdline, &ntokens);
+
+  if (ntokens > 0 && pure_pipeline_p(token, ntokens)) {
+    outbuf_t discard = {};
+    for (int i = 0, j; i < ntokens; i = j + 1) {
+      for (j = i; j < ntokens && token[j] != T_PIPE; j++)
+        continue;
+      token[j] = T_NULL;
+      /* Only the last builtin of a pipeline has its output captured. */
+      discard.len = 0;
+      builtin_output(-1, j == ntokens ? &buf : &discard);
+      builtin_command(&token[i]);
+    }
+    builtin_output(STDOUT_FILENO, NULL);
+    free(discard.data);
+  } else if (ntokens > 0) {
+    int input, output;
+    mkpipe(&input, &output);
+
+    pid_t pid = Fork();
+    if (pid == 0) {
+      Dup2(output, STDOUT_FILENO);
+      Close(output);
+      Close(input);
+      exit(evaltokens(token, ntokens));
+    }
+    Close(output);
+
+    for (;;) {
+      if (buf.cap - buf.len < 65536 + 1) {
+        buf.cap = max(buf.cap * 2, buf.len + 65536 + 1);
+        buf.data = realloc(buf.data, buf.cap);
+      }
+      ssize_t n = read(input, buf.data + buf.len, buf.cap - buf.len - 1);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      buf.len += n;
+    }
+    Close(input);
+
+    while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+      continue;
+  }
+
+  free(token);
+
+  if (buf.data == NULL)
+    return strdup("");
+  while (buf.len > 0 && buf.data[buf.len - 1] == '\n')
+    buf.len--;
+  buf.data[buf.len] = '\0';
+  return buf.data;
+}
+
+#ifdef READLINE
+/* Search persistent history for the text typed so far. Pressing C-r again
+ * finds older commands containing the same text. */
+static int reverse_search(int count, int key) {
+  static char *pattern = NULL;
+  static int found = INT_MAX;
+
+  if (rl_last_func != reverse_search) {
+    free(pattern);
+    pattern = strdup(rl_line_buffer);
+    found = INT_MAX;
+  }
+
+  int i = history_find(pattern, found);
+  if (i < 0)
+    return rl_ding();
+
+  found = i;
+  rl_replace_line(history_command(i), 0);
+  rl_point = rl_end;
+  return 0;
+}
+
+/* Generate names of executables from PATH matching `text`. */
+static char *complete_command(const char *text, int state) {
+  static const char **match;
+  static int count, next;
+
+  if (state == 0) {
+    match = pathindex_complete(text, &count);
+    next = 0;
+  }
+
+  return next < count ? strdup(match[next++]) : NULL;
+}
+
+/* First word of a line is completed with command names, the rest with file
+ * names, which is what readline does by default. */
+static char **complete(const char *text, int start, int end) {
+  (void)end;
+  if (start > 0)
+    return NULL;
+  return rl_completion_matches(text, complete_command);
+}
+#endif
+
 #ifndef READLINE
+/* Terminal input is kept in a buffer that grows as needed, so a single read
+ * may queue many lines and a line may be longer than MAXLINE. Unconsumed
+ * input starts at `inpos` and ends at `inlen`. */
+static char *inbuf = NULL;
+static size_t inpos = 0, inlen = 0, incap = 0;
+
+/* Takes next complete line out of the buffer, if there's one. */
+static char *nextline(void) {
+  char *start = inbuf + inpos;
+  char *nl = memchr(start, '\n', inlen - inpos);
+
+  if (nl == NULL)
+    return NULL;
+
+  *nl = '\0';
+  inpos = nl - inbuf + 1;
+  return strdup(start);
+}
+
+/* Checks if the terminal has complete lines that we haven't read yet. */
+static bool typeahead(void) {
+  int n;
+  return ioctl(STDIN_FILENO, FIONREAD, &n) == 0 && n > 0;
+}
+
 static char *readline(const char *prompt) {
-  static char line[MAXLINE]; /* `readline` is clearly not reentrant! */
+  char *line;
+
+  if ((line = nextline()))
+    return line;
+
+  /* Queued lines are executed back-to-back without redrawing the prompt. */
+  if (!typeahead())
+    write(STDOUT_FILENO, prompt, strlen(prompt));
+
+  for (;;) {
+    /* Move unfinished line to the front and make room for more input. */
+    inlen -= inpos;
+    memmove(inbuf, inbuf + inpos, inlen);
+    inpos = 0;
+    while (incap - inlen < MAXLINE) {
+      incap = incap ? incap * 2 : MAXLINE * 2;
+      inbuf = realloc(inbuf, incap);
+    }
 
-  write(STDOUT_FILENO, prompt, strlen(prompt));
+    ssize_t nread = read(STDIN_FILENO, inbuf + inlen, incap - inlen);
+    if (nread < 0) {
+      if (errno != EINTR)
+        unix_error("Read error");
+      msg("\n");
+      inlen = 0; /* forget whatever was typed before ^C */
+      return strdup("");
+    }
 
-  line[0] = '\0';
+    if (nread == 0) {
+      if (inlen == 0)
+        return NULL; /* EOF */
+      /* Last line before EOF lacks newline character. */
+      inbuf[inlen] = '\0';
+      inlen = 0;
+      return strdup(inbuf);
+    }
 
-  ssize_t nread = read(STDIN_FILENO, line, MAXLINE);
-  if (nread < 0) {
-    if (errno != EINTR)
-      unix_error("Read error");
-    msg("\n");
-  } else if (nread == 0) {
-    return NULL; /* EOF */
-  } else {
-    if (line[nread - 1] == '\n')
-      line[nread - 1] = '\0';
+    inlen += nread;
+    if ((line = nextline()))
+      return line;
   }
-
-  return strdup(line);
 }
 #endif
 
-int main(int argc, char *argv[]) {
-  /* `stdin` should be attached to terminal running in canonical mode */
-  if (!isatty(STDIN_FILENO))
-    app_error("ERROR: Shell can run only in interactive mode!");
+static const struct option options[] = {
+  {"server", required_argument, NULL, 's'},
+  {"startup-profile", no_argument, NULL, 'p'},
+  {NULL, 0, NULL, 0},
+};
+
+/* With --startup-profile time spent in each phase of startup is reported. */
+static bool profile = false;
+static uint64_t phase_start;
+
+static void phase(const char *name) {
+  if (!profile)
+    return;
+  uint64_t now = stats_clock();
+  msg("startup: %-10s %8.1f us\n", name, (double)(now - phase_start) / 1000);
+  phase_start = now;
+}
 
 #ifdef READLINE
+/* Readline is set up only before the first interactive read. */
+static void initreadline(void) {
+  static bool ready = false;
+  if (ready)
+    return;
+  ready = true;
+
   rl_initialize();
+
+  /* Let arrow keys reach commands from previous sessions. */
+  for (int i = max(0, history_count() - 1000); i < history_count(); i++)
+    add_history(history_command(i));
+  rl_bind_keyseq("\\C-r", reverse_search);
+  rl_attempted_completion_function = complete;
+}
 #endif
 
+int main(int argc, char *argv[]) {
+  uint64_t start = phase_start = stats_clock();
+  const char *server = NULL, *command = NULL;
+  int opt;
+
+  while ((opt = getopt_long(argc, argv, "c:", options, NULL)) != -1) {
+    if (opt == 's')
+      server = optarg;
+    else if (opt == 'c')
+      command = optarg;
+    else if (opt == 'p')
+      profile = true;
+    else
+      app_error("Usage: %s [-c command] [--server PATH] [--startup-profile]",
+                argv[0]);
+  }
+
+  /* Without -c or --server commands are read from the terminal. */
+  interactive = !server && !command;
+
+  /* `stdin` should be attached to terminal running in canonical mode */
+  if (interactive && !isatty(STDIN_FILENO))
+    app_error("ERROR: Shell can run only in interactive mode!");
+
   sigemptyset(&sigchld_mask);
   sigaddset(&sigchld_mask, SIGCHLD);
 
-  if (getsid(0) != getpgid(0))
+  initvars();
+  phase("vars");
+  initstats();
+  phase("stats");
+  initjoblog();
+  phase("joblog");
+  if (interactive) {
+    inithistory();
+    phase("history");
+  }
+  /* A single command doesn't pay for starting the spawn server. */
+  if (!command) {
+    initspawnd();
+    phase("spawnd");
+  }
+
+  if (interactive && getsid(0) != getpgid(0))
     Setpgid(0, 0);
 
-  initjobs();
+  initjobs(interactive);
+  phase("jobs");
 
   struct sigaction act = {
     .sa_handler = sigint_handler,
@@ -391,8 +1235,31 @@ int main(int argc, char *argv[]) {
   Signal(SIGTSTP, SIG_IGN);
   Signal(SIGTTIN, SIG_IGN);
   Signal(SIGTTOU, SIG_IGN);
+  phase("signals");
+
+  if (profile)
+    msg("startup: %-10s %8.1f us\n", "total",
+        (double)(stats_clock() - start) / 1000);
+
+  if (server)
+    serve(server, eval);
+
+  if (command) {
+    char *line = strdup(command);
+    oneshot = true;
+    int exitcode = eval(line);
+    free(line);
+    joblog_flush();
+    return exitcode;
+  }
 
   while (true) {
+    joblog_flush();
+    pathindex_refresh();
+
+#ifdef READLINE
+    initreadline();
+#endif
     char *line = readline("# ");
 
     if (line == NULL)
@@ -402,7 +1269,14 @@ int main(int argc, char *argv[]) {
 #ifdef READLINE
       add_history(line);
 #endif
-      eval(line);
+      /* `eval` modifies the line, so keep a copy for history. */
+      char *cmd = strdup(line);
+      time_t started = time(NULL);
+      uint64_t start = stats_clock();
+      int exitcode = eval(line);
+      setstatus(exitcode);
+      history_append(cmd, started, (stats_clock() - start) / 1000, exitcode);
+      free(cmd);
     }
     free(line);
     watchjobs(FINISHED);
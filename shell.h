@@ -2,6 +2,7 @@
 #define _SHELL_H_
 
 #include "csapp.h"
+#include "fdmove.h"
 
 #define msg(...) dprintf(STDERR_FILENO, __VA_ARGS__)
 
@@ -23,11 +24,21 @@ typedef char *token_t;
 #define T_INPUT ((token_t)7)
 #define T_APPEND ((token_t)8)
 #define T_BANG ((token_t)9)
+#define T_FANOUT ((token_t)10)
+#define T_HEREDOC ((token_t)11)
+#define T_HERESTR ((token_t)12)
+#define T_IONUM ((token_t)13)  /* next word is a descriptor number */
+#define T_DUPIN ((token_t)14)  /* <& */
+#define T_DUPOUT ((token_t)15) /* >& */
+#define T_RDWR ((token_t)16)   /* <> */
 #define separator_p(t) ((t) <= T_COLON)
-#define string_p(t) ((t) > T_BANG)
+#define string_p(t) ((t) > T_RDWR)
 
 void strapp(char **dstp, const char *src);
 token_t *tokenize(char *s, int *tokc_p);
+size_t substlen(const char *s);
+bool procsubst_p(const char *word);
+char *cmdsubst(char *cmdline);
 
 /* Do not change those values or code will break! */
 enum {
@@ -43,23 +54,144 @@ enum {
   STOPPED = 2,  /* jobs that have been suspended by SIGTSTP / SIGSTOP */
 };
 
-void initjobs(void);
+void initjobs(bool interactive);
 void shutdownjobs(void);
+void forgetjobs(void);
 
 int addjob(pid_t pgid, int bg);
 void addproc(int job, pid_t pid, char **argv);
 bool killjob(int job);
 void watchjobs(int state);
 char *jobcmd(int job);
+int jobprocs(int job, pid_t *pids, int max, int *statep);
+int jobslots(void);
 bool resumejob(int job, int bg, sigset_t *mask);
 int monitorjob(sigset_t *mask);
+void batchjob(int job);
+pid_t batchwait(int job, int n, sigset_t *mask);
+void dropjob(int job);
 
 void setfgpgrp(pid_t pgid);
+void releasefd(int fd);
 
 int builtin_command(char **argv);
 noreturn void external_command(char **argv);
 
+/* Growable memory buffer, always NUL-terminated once allocated. */
+typedef struct outbuf {
+  char *data;
+  size_t len, cap;
+} outbuf_t;
+
+void outbuf_append(outbuf_t *buf, const char *data, size_t len);
+void outbuf_printf(outbuf_t *buf, const char *fmt, ...);
+void builtin_output(int fd, outbuf_t *buf);
+bool builtin_p(char **argv);
+bool pure_builtin_p(char **argv);
+
+/* Body of the helper process of fan-out operator `|>`. */
+noreturn void fanout(int input, int *output, int n);
+
+/* Descriptors of a command being started (see redir.c). */
+typedef struct redir {
+  fdmove_t *move; /* descriptors to be changed */
+  int n;          /* number of moves */
+  int *opened;    /* descriptors opened for the command */
+  int nopened;    /* number of opened descriptors */
+} redir_t;
+
+void redir_init(redir_t *r, int input, int output);
+void redir_set(redir_t *r, int dst, int src, bool cloexec);
+void redir_open(redir_t *r, int dst, int fd);
+int redir_source(redir_t *r, int fd, bool *cloexecp);
+int redir_persist(redir_t *r);
+void redir_adopt(int fd);
+void redir_done(redir_t *r);
+int do_redir(token_t *token, int ntokens, redir_t *r);
+
+/* Resource monitor of jobs (see top.c). */
+int monitorjobs(int interval);
+
+/* Command server mode (see server.c). */
+noreturn void serve(const char *path, int (*eval)(char *cmdline));
+
+/* Creating processes by the spawn server. */
+void initspawnd(void);
+pid_t spawn(char **argv, pid_t pgid, bool fg, redir_t *r);
+
+/* Shell-internal latency histograms. */
+enum {
+  S_TOKENIZE,   /* splitting command line into tokens */
+  S_REDIR,      /* processing redirections */
+  S_FORK,       /* creating a subprocess (as seen by the parent) */
+  S_EXECVE,     /* from fork till calling execve (as seen by the child) */
+  S_SETFGPGRP,  /* passing the terminal to a process group */
+  S_TCSETATTR,  /* restoring terminal attributes */
+  S_SIGSUSPEND, /* waiting for a job to change its state */
+  S_REAP,       /* running SIGCHLD handler */
+  NSTATS
+};
+
+void initstats(void);
+uint64_t stats_clock(void);
+void stats_record(int which, uint64_t start);
+void stats_print(outbuf_t *out);
+void stats_reset(void);
+
+/* Job lifecycle event log. */
+enum {
+  EV_SPAWN, /* job was created */
+  EV_PROC,  /* process was added to a job */
+  EV_STOP,  /* process was stopped */
+  EV_CONT,  /* process was continued */
+  EV_EXIT,  /* process exited or was killed by a signal */
+  EV_DONE,  /* finished job was deleted */
+};
+
+void initjoblog(void);
+bool joblog_sample(void);
+void joblog(int type, int job, pid_t pgid, pid_t pid, int status,
+            uint64_t duration, const char *text);
+void joblog_flush(void);
+
+/* Persistent command history. */
+void inithistory(void);
+void history_append(const char *cmd, int64_t time, uint64_t duration,
+                    int exitcode);
+int history_count(void);
+const char *history_command(int i);
+int history_find(const char *pattern, int before);
+void history_print(outbuf_t *out, const char *pattern);
+
+/* Index of executables in PATH directories. */
+void pathindex_refresh(void);
+const char *pathindex_lookup(const char *name);
+const char **pathindex_complete(const char *prefix, int *countp);
+
+/* Pathname expansion. */
+bool wildcard_p(const char *word);
+char **glob_expand(const char *pattern, int *countp);
+
+/* Shell variables and environment of subprocesses. */
+void initvars(void);
+const char *getvar(const char *name);
+const char *getvarn(const char *name, size_t len);
+void setvar(const char *name, const char *value, bool export);
+void unsetvar(const char *name);
+bool name_p(const char *word);
+bool assignment_p(const char *word);
+void assign(const char *word, bool export);
+void pushvars(char **words, int n);
+void popvars(void);
+void printvars(outbuf_t *out);
+char **getenvp(void);
+void setstatus(int exitcode);
+size_t expand(char *dst, const char *src);
+
 /* Used by Sigprocmask to enter critical section protecting against SIGCHLD. */
 extern sigset_t sigchld_mask;
 
+/* Time just before subprocess creation, used by the child to time execve. */
+extern uint64_t spawn_start;
+
 #endif /* !_SHELL_H_ */
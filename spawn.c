@@ -0,0 +1,162 @@
+#include "shell.h"
+#include "spawnd.h"
+
+/* Client of the spawn server (see spawnd.c). If SHELL_SPAWND names the server
+ * executable, it's started along with the shell and external commands are
+ * created by it instead of by forking the shell. Processes it creates are
+ * children of the shell, so they are reaped as usual. If the server goes
+ * away, the shell falls back to fork. */
+
+static int spawnd_fd = -1;
+static pid_t spawnd_pid = -1;
+static pid_t owner = -1; /* processes are created for this shell only */
+static char *reqbuf = NULL; /* strings of a request */
+static size_t reqcap = 0;
+
+static void spawnd_lost(void) {
+  msg("spawnd: server is gone, falling back to fork\n");
+  Close(spawnd_fd);
+  spawnd_fd = -1;
+  waitpid(spawnd_pid, NULL, WNOHANG);
+}
+
+static bool sendall(const void *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = send(spawnd_fd, buf, len, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    buf += n, len -= n;
+  }
+  return true;
+}
+
+static void reserve(size_t size) {
+  if (size > reqcap) {
+    while (size > reqcap)
+      reqcap = reqcap ? reqcap * 2 : 65536;
+    reqbuf = realloc(reqbuf, reqcap);
+  }
+}
+
+static size_t append(size_t size, const char *s) {
+  size_t len = strlen(s) + 1;
+  reserve(size + len);
+  memcpy(reqbuf + size, s, len);
+  return size + len;
+}
+
+/* Ask the server to create a process running external command `argv` in
+ * process group `pgid` (0 for a new one), with descriptors set up as in `r`.
+ * Returns pid of the process, or -1 if the command has to be started by
+ * forking the shell. */
+pid_t spawn(char **argv, pid_t pgid, bool fg, redir_t *r) {
+  /* Children of a subshell must be its own, so it forks them. */
+  if (spawnd_fd < 0 || getpid() != owner)
+    return -1;
+  if (assignment_p(argv[0]) || builtin_p(argv))
+    return -1;
+  if (r->n + 3 > SPAWND_MAXFDS)
+    return -1;
+
+  /* Path is resolved here, since the shell keeps the index. */
+  const char *path = NULL;
+  if (!strchr(argv[0], '/'))
+    path = pathindex_lookup(argv[0]);
+
+  /* Server's own standard descriptors are not the shell's, so these are always
+   * passed. Beyond them the server starts commands with nothing open. */
+  spawnreq_t req = {.pgid = pgid, .fg = fg};
+  int fds[SPAWND_MAXFDS], nfds = 0;
+  int32_t table[SPAWND_MAXFDS];
+
+  for (int fd = 0; fd < 3; fd++) {
+    int src = redir_source(r, fd, NULL);
+    table[req.nfds++] = src < 0 ? ~fd : fd;
+    if (src >= 0)
+      fds[nfds++] = src;
+  }
+  for (int i = 0; i < r->n; i++) {
+    int fd = r->move[i].dst, src = r->move[i].src;
+    if (fd < 3)
+      continue;
+    table[req.nfds++] = src < 0 ? ~fd : fd;
+    if (src >= 0)
+      fds[nfds++] = src;
+  }
+
+  if (nfds == 0)
+    return -1;
+
+  size_t size = sizeof(int32_t) * req.nfds;
+  reserve(size);
+  memcpy(reqbuf, table, size);
+
+  char cwd[PATH_MAX];
+  if (getcwd(cwd, sizeof(cwd)) == NULL)
+    return -1;
+
+  char **envp = getenvp();
+  size = append(size, cwd);
+  size = append(size, path ? path : argv[0]);
+  for (; argv[req.argc]; req.argc++)
+    size = append(size, argv[req.argc]);
+  for (; envp[req.envc]; req.envc++)
+    size = append(size, envp[req.envc]);
+  req.size = size;
+
+  char control[CMSG_SPACE(sizeof(fds))] = {};
+  struct iovec iov = {.iov_base = &req, .iov_len = sizeof(req)};
+  struct msghdr mh = {.msg_iov = &iov,
+                      .msg_iovlen = 1,
+                      .msg_control = control,
+                      .msg_controllen = CMSG_SPACE(sizeof(int) * nfds)};
+  struct cmsghdr *cm = CMSG_FIRSTHDR(&mh);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+
+  ssize_t n;
+  while ((n = sendmsg(spawnd_fd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+    continue;
+
+  int32_t pid;
+  if (n != sizeof(req) || !sendall(reqbuf, size) ||
+      read(spawnd_fd, &pid, sizeof(pid)) != sizeof(pid)) {
+    spawnd_lost();
+    return -1;
+  }
+
+  return pid > 0 ? pid : -1;
+}
+
+/* Called just at the beginning of shell's life. */
+void initspawnd(void) {
+  const char *path = getenv("SHELL_SPAWND");
+  if (path == NULL)
+    return;
+
+  int sv[2];
+  Socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+
+  owner = getpid();
+  if ((spawnd_pid = Fork()) == 0) {
+    char fd[16];
+    snprintf(fd, sizeof(fd), "%d", sv[1]);
+    Close(sv[0]);
+    execl(path, path, fd, NULL);
+    msg("spawnd: %s: %s\n", path, strerror(errno));
+    exit(EXIT_FAILURE);
+  }
+
+  /* Keep low descriptor numbers available for the user. */
+  Close(sv[1]);
+  spawnd_fd = fcntl(sv[0], F_DUPFD_CLOEXEC, 10);
+  Close(sv[0]);
+
+  int32_t ready;
+  if (read(spawnd_fd, &ready, sizeof(ready)) != sizeof(ready))
+    spawnd_lost();
+}
@@ -0,0 +1,200 @@
+/* Spawn server. Creating a process by forking the shell gets expensive as
+ * the shell grows: all of its mappings (and shadow memory of the address
+ * sanitizer) have to be copied. This small program is started by the shell
+ * (see spawn.c) and creates processes on its behalf from its own image.
+ *
+ * Usage: spawnd fd
+ *
+ * Requests come over the socket `fd` (see spawnd.h). New processes are
+ * created with CLONE_PARENT, so they become children of the shell, which
+ * reaps them and gets notified when they stop just like with fork.
+ *
+ * It's built without the sanitizer and libcsapp to keep it small. */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "fdmove.h"
+#include "spawnd.h"
+
+static int sock;
+static int tty_fd;
+
+/* Read exactly `len` bytes. Descriptors that come with the first chunk are
+ * stored in `fds` and their number in `nfdsp`. Returns false at end of file. */
+static bool receive(void *buf, size_t len, int *fds, int *nfdsp) {
+  char control[CMSG_SPACE(sizeof(int) * SPAWND_MAXFDS)];
+
+  while (len > 0) {
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    struct msghdr mh = {.msg_iov = &iov, .msg_iovlen = 1};
+    if (fds) {
+      mh.msg_control = control;
+      mh.msg_controllen = sizeof(control);
+    }
+
+    ssize_t n = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    struct cmsghdr *cm = fds ? CMSG_FIRSTHDR(&mh) : NULL;
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      *nfdsp = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cm), sizeof(int) * *nfdsp);
+      fds = NULL;
+    }
+
+    buf += n, len -= n;
+  }
+
+  return true;
+}
+
+/* Runs in the new process. Mirrors what the shell does after fork. */
+static _Noreturn void child(spawnreq_t *req, const char *cwd,
+                            const char *path, char **argv, char **envp,
+                            fdop_t *op, int nop) {
+  pid_t pgid = req->pgid ? req->pgid : getpid();
+
+  setpgid(0, pgid);
+  if (req->fg)
+    tcsetpgrp(tty_fd, pgid);
+
+  signal(SIGINT, SIG_DFL);
+  signal(SIGQUIT, SIG_DFL);
+  signal(SIGTSTP, SIG_DFL);
+  signal(SIGTTIN, SIG_DFL);
+  signal(SIGTTOU, SIG_DFL);
+
+  if (fdmove_apply(op, nop) < 0 || chdir(cwd) < 0) {
+    dprintf(STDERR_FILENO, "%s: %s\n", argv[0], strerror(errno));
+    _exit(126);
+  }
+
+  environ = envp;
+  if (strchr(path, '/'))
+    execve(path, argv, envp);
+  else
+    execvp(path, argv);
+
+  dprintf(STDERR_FILENO, "%s: %s\n", argv[0], strerror(errno));
+  _exit(errno == ENOENT ? 127 : 126);
+}
+
+/* Builds the descriptor table of the request from descriptors received. They
+ * are all close-on-exec, so only those in the table survive. */
+static int plan(spawnreq_t *req, int32_t *table, int *fds, int nfds,
+                fdop_t *op) {
+  fdmove_t move[SPAWND_MAXFDS];
+  int k = 0;
+
+  for (int i = 0; i < req->nfds; i++) {
+    if (table[i] >= 0 && k == nfds)
+      return -1;
+    move[i] = table[i] >= 0
+                ? (fdmove_t){.dst = table[i], .src = fds[k++], .cloexec = true}
+                : (fdmove_t){.dst = ~table[i], .src = -1};
+  }
+
+  return k == nfds ? fdmove_plan(move, req->nfds, op) : -1;
+}
+
+static int32_t spawn(spawnreq_t *req, char *data, int *fds, int nfds) {
+  fdop_t op[2 * SPAWND_MAXFDS];
+  int nop = plan(req, (int32_t *)data, fds, nfds, op);
+  if (nop < 0)
+    return -EBADF;
+
+  char *cwd = data + sizeof(int32_t) * req->nfds;
+  char *path = cwd + strlen(cwd) + 1;
+  char **argv = malloc(sizeof(char *) * (req->argc + req->envc + 2));
+  char **envp = argv + req->argc + 1;
+
+  char *s = path + strlen(path) + 1;
+  for (int i = 0; i < req->argc; i++, s += strlen(s) + 1)
+    argv[i] = s;
+  argv[req->argc] = NULL;
+  for (int i = 0; i < req->envc; i++, s += strlen(s) + 1)
+    envp[i] = s;
+  envp[req->envc] = NULL;
+
+  /* Like fork, but the child's parent is the shell. */
+  pid_t pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, NULL, NULL, NULL, 0);
+  if (pid == 0)
+    child(req, cwd, path, argv, envp, op, nop);
+
+  /* Process group is set by the child and by its parent, i.e. the shell. */
+  free(argv);
+  return pid < 0 ? -errno : pid;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s fd\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  sock = atoi(argv[1]);
+  fcntl(sock, F_SETFD, FD_CLOEXEC);
+
+  /* Standard input is the shell's terminal. */
+  tty_fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+
+  /* We're in the shell's process group, so it's the shell that handles these
+   * signals. Children restore default actions. */
+  signal(SIGINT, SIG_IGN);
+  signal(SIGQUIT, SIG_IGN);
+  signal(SIGTSTP, SIG_IGN);
+  signal(SIGTTIN, SIG_IGN);
+  signal(SIGTTOU, SIG_IGN);
+
+  sigset_t empty;
+  sigemptyset(&empty);
+  sigprocmask(SIG_SETMASK, &empty, NULL);
+
+  /* Tell the shell we're ready. */
+  int32_t ready = 0;
+  if (write(sock, &ready, sizeof(ready)) != sizeof(ready))
+    return EXIT_FAILURE;
+
+  char *data = NULL;
+  size_t cap = 0;
+
+  for (;;) {
+    spawnreq_t req;
+    int fds[SPAWND_MAXFDS], nfds = 0;
+
+    if (!receive(&req, sizeof(req), fds, &nfds))
+      break;
+    if (req.size > cap)
+      data = realloc(data, cap = req.size);
+    if (!receive(data, req.size, NULL, NULL))
+      break;
+
+    int32_t pid = -EBADF;
+    if (req.nfds > 0 && req.nfds <= SPAWND_MAXFDS &&
+        sizeof(int32_t) * req.nfds < req.size)
+      pid = spawn(&req, data, fds, nfds);
+
+    for (int i = 0; i < nfds; i++)
+      close(fds[i]);
+
+    if (write(sock, &pid, sizeof(pid)) != sizeof(pid))
+      break;
+  }
+
+  /* The shell has gone, so have we. */
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef _SPAWND_H_
+#define _SPAWND_H_
+
+#include <stdint.h>
+
+/* Protocol between the shell and spawn server (spawnd.c). The shell writes a
+ * request header, that carries descriptors for the new process as SCM_RIGHTS,
+ * and then `size` bytes of payload. The payload starts with a table of `nfds`
+ * descriptor numbers: each non-negative entry `fd` is set to the next passed
+ * descriptor, and each negative one is `~fd` to be closed. Then follow
+ * NUL-terminated strings: working directory, path of the executable, `argc`
+ * arguments and `envc` environment variables. The server replies with pid of the new process, or
+ * minus errno if it couldn't create one. The process is created as a child of
+ * the shell, so the shell waits for it as for any other child. */
+
+#define SPAWND_MAXFDS 64
+
+typedef struct spawnreq {
+  uint32_t size; /* bytes of payload following the header */
+  int32_t pgid;  /* process group to join, 0 to lead a new one */
+  int32_t fg;    /* give the terminal to the process group */
+  int32_t nfds;  /* number of entries in the descriptor table */
+  int32_t argc;  /* number of arguments */
+  int32_t envc;  /* number of environment variables */
+} spawnreq_t;
+
+#endif /* !_SPAWND_H_ */
@@ -0,0 +1,79 @@
+#include "shell.h"
+#include "hist.h"
+
+static const char *statname[NSTATS] = {
+  [S_TOKENIZE] = "tokenize",     [S_REDIR] = "redir",
+  [S_FORK] = "fork",             [S_EXECVE] = "execve",
+  [S_SETFGPGRP] = "setfgpgrp",   [S_TCSETATTR] = "tcsetattr",
+  [S_SIGSUSPEND] = "sigsuspend", [S_REAP] = "reap",
+};
+
+/* Histograms live in shared memory, so that children can record how long it
+ * took them to get from fork to execve. */
+static hist_t *hists = NULL;
+static pid_t owner = 0;
+
+uint64_t spawn_start;
+
+uint64_t stats_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Safe to call from signal handlers and from children sharing the table. */
+void stats_record(int which, uint64_t start) {
+  hist_record(&hists[which], stats_clock() - start);
+}
+
+#define US(ns) ((double)(ns) / 1000.0)
+
+void stats_print(outbuf_t *out) {
+  outbuf_printf(out, "%-12s %8s %10s %10s %10s %10s\n", "(usec)", "count",
+                "mean", "p50", "p99", "max");
+  for (int i = 0; i < NSTATS; i++) {
+    hist_t *h = &hists[i];
+    if (h->count == 0) {
+      outbuf_printf(out, "%-12s %8d %10s %10s %10s %10s\n", statname[i], 0,
+                    "-", "-", "-", "-");
+      continue;
+    }
+    outbuf_printf(out, "%-12s %8lu %10.1f %10.1f %10.1f %10.1f\n",
+                  statname[i], h->count, US(h->sum / h->count),
+                  US(hist_percentile(h, 50)), US(hist_percentile(h, 99)),
+                  US(h->max));
+  }
+}
+
+void stats_reset(void) {
+  memset(hists, 0, sizeof(hist_t) * NSTATS);
+}
+
+/* If SHELL_STATS names a file, then dump histograms there when shell exits. */
+static void stats_dump(void) {
+  const char *path = getenv("SHELL_STATS");
+
+  /* Children inherit atexit handlers, but only the shell should dump stats. */
+  if (path == NULL || getpid() != owner)
+    return;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    msg("stats: %s: %s\n", path, strerror(errno));
+    return;
+  }
+  outbuf_t out = {};
+  stats_print(&out);
+  if (out.len > 0 && write(fd, out.data, out.len) < 0)
+    msg("stats: %s: %s\n", path, strerror(errno));
+  free(out.data);
+  close(fd);
+}
+
+/* Called just at the beginning of shell's life. */
+void initstats(void) {
+  hists = Mmap(NULL, sizeof(hist_t) * NSTATS, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  owner = getpid();
+  atexit(stats_dump);
+}
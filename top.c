@@ -0,0 +1,268 @@
+#include "shell.h"
+
+/* Resource monitor run by `jobs -r`. For every process of a job it reads
+ * /proc/<pid>/stat (state and CPU time), statm (resident memory) and io
+ * (bytes passed through read and write calls), and shows their sums per job.
+ * CPU usage is the share of one CPU since the previous refresh, or since the
+ * process started on the first one.
+ *
+ * Files of a process are opened when it shows up and stay open until it
+ * leaves the job table, so a refresh costs a single pread per file. An open
+ * file also sticks to its process: once it's reaped, reads fail with ESRCH
+ * instead of describing another process that got the same pid.
+ *
+ * On a terminal the picture is refreshed every `interval` milliseconds until
+ * a key is pressed or no process is left. Otherwise it's printed once. */
+
+#define MAXPROCS 64 /* processes of a job that are sampled */
+
+enum { STAT, STATM, IO, NFILES };
+
+static const char *procfile[NFILES] = {"stat", "statm", "io"};
+
+typedef struct sample {
+  pid_t pid;
+  int fd[NFILES];
+  uint64_t ticks; /* user and system time at previous refresh */
+  uint64_t when;  /* time of previous refresh (since boot, in ns) */
+  bool seen;      /* process is still in the job table */
+} sample_t;
+
+typedef struct usage {
+  double cpu;            /* percent of one CPU */
+  uint64_t rss;          /* resident memory in bytes */
+  uint64_t rchar, wchar; /* bytes read and written */
+  char state;            /* as in /proc/<pid>/stat */
+} usage_t;
+
+static sample_t *sample = NULL;
+static int nsamples = 0;
+
+/* Processes report start time in clock ticks since boot. */
+static uint64_t boottime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static sample_t *getsample(pid_t pid) {
+  for (int i = 0; i < nsamples; i++)
+    if (sample[i].pid == pid)
+      return &sample[i];
+
+  sample = realloc(sample, sizeof(sample_t) * (nsamples + 1));
+  sample_t *s = &sample[nsamples++];
+  *s = (sample_t){.pid = pid};
+
+  for (int i = 0; i < NFILES; i++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, procfile[i]);
+    s->fd[i] = open(path, O_RDONLY | O_CLOEXEC);
+  }
+  return s;
+}
+
+/* Close files of processes that are gone, or of all if `all` is set. */
+static void dropsamples(bool all) {
+  int n = 0;
+  for (int i = 0; i < nsamples; i++) {
+    if (sample[i].seen && !all) {
+      sample[n++] = sample[i];
+      continue;
+    }
+    for (int k = 0; k < NFILES; k++)
+      if (sample[i].fd[k] >= 0)
+        Close(sample[i].fd[k]);
+  }
+  nsamples = n;
+  if (all) {
+    free(sample);
+    sample = NULL;
+  }
+}
+
+static bool readfile(sample_t *s, int which, char *buf, size_t size) {
+  if (s->fd[which] < 0)
+    return false;
+  ssize_t n = pread(s->fd[which], buf, size - 1, 0);
+  if (n <= 0)
+    return false;
+  buf[n] = '\0';
+  return true;
+}
+
+/* Returns false if the process has gone. */
+static bool getusage(sample_t *s, uint64_t now, usage_t *u) {
+  static long hz = 0, pagesize = 0;
+  if (hz == 0) {
+    hz = sysconf(_SC_CLK_TCK);
+    pagesize = sysconf(_SC_PAGESIZE);
+  }
+
+  char buf[1024];
+  *u = (usage_t){};
+
+  /* Command name is in parentheses and may contain anything. */
+  char *p;
+  if (!readfile(s, STAT, buf, sizeof(buf)) || !(p = strrchr(buf, ')')))
+    return false;
+
+  unsigned long utime, stime;
+  unsigned long long start;
+  if (sscanf(p + 1,
+             " %c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu"
+             " %*d %*d %*d %*d %*d %*d %llu",
+             &u->state, &utime, &stime, &start) != 4)
+    return false;
+
+  if (s->when == 0)
+    s->when = start * 1000000000 / hz;
+  uint64_t ticks = utime + stime;
+  if (now > s->when)
+    u->cpu = 100.0 * (ticks - s->ticks) / hz * 1e9 / (now - s->when);
+  s->ticks = ticks;
+  s->when = now;
+
+  unsigned long resident;
+  if (readfile(s, STATM, buf, sizeof(buf)) &&
+      sscanf(buf, "%*u %lu", &resident) == 1)
+    u->rss = (uint64_t)resident * pagesize;
+
+  /* Not readable if the process changed its credentials. */
+  unsigned long rchar, wchar;
+  if (readfile(s, IO, buf, sizeof(buf)) &&
+      sscanf(buf, "rchar: %lu wchar: %lu", &rchar, &wchar) == 2)
+    u->rchar = rchar, u->wchar = wchar;
+
+  return true;
+}
+
+static char *human(char *buf, uint64_t bytes) {
+  static const char unit[] = "BKMGTP";
+  double v = bytes;
+  int i = 0;
+  while (v >= 1024 && unit[i + 1])
+    v /= 1024, i++;
+  if (i == 0)
+    sprintf(buf, "%luB", (unsigned long)bytes);
+  else
+    sprintf(buf, v < 10 ? "%.1f%c" : "%.0f%c", v, unit[i]);
+  return buf;
+}
+
+/* Print a picture of all jobs. Returns number of processes still alive. */
+static int refresh(bool clear) {
+  static const char *statename[] = {"finished", "running", "suspended"};
+  outbuf_t out = {};
+  char line[128], rss[16], rd[16], wr[16];
+  int alive = 0;
+
+  if (clear)
+    outbuf_append(&out, "\033[H\033[J", 6);
+  int len = snprintf(line, sizeof(line), "%-5s %-9s %-8s %6s %7s %7s %7s %s\n",
+                     "JOB", "STATE", "PROCS", "CPU%", "RSS", "READ", "WRITE",
+                     "COMMAND");
+  outbuf_append(&out, line, len);
+
+  sigset_t mask;
+  Sigprocmask(SIG_BLOCK, &sigchld_mask, &mask);
+
+  uint64_t now = boottime();
+  for (int i = 0; i < nsamples; i++)
+    sample[i].seen = false;
+
+  for (int j = BG; j < jobslots(); j++) {
+    pid_t pid[MAXPROCS];
+    int state, n = jobprocs(j, pid, MAXPROCS, &state);
+    if (n < 0)
+      continue;
+
+    usage_t total = {};
+    char states[9] = "-";
+    int nstates = 0;
+
+    for (int i = 0; i < n; i++) {
+      sample_t *s = getsample(pid[i]);
+      usage_t u;
+      s->seen = true;
+      if (!getusage(s, now, &u))
+        continue;
+      total.cpu += u.cpu;
+      total.rss += u.rss;
+      total.rchar += u.rchar;
+      total.wchar += u.wchar;
+      if (nstates < 8)
+        states[nstates++] = u.state, states[nstates] = '\0';
+      alive++;
+    }
+
+    char job[16];
+    snprintf(job, sizeof(job), "[%d]", j);
+    len = snprintf(line, sizeof(line), "%-5s %-9s %-8s %6.1f %7s %7s %7s ",
+                   job, statename[state], states, total.cpu,
+                   human(rss, total.rss), human(rd, total.rchar),
+                   human(wr, total.wchar));
+    outbuf_append(&out, line, len);
+    outbuf_append(&out, jobcmd(j), strlen(jobcmd(j)));
+    outbuf_append(&out, "\n", 1);
+  }
+
+  Sigprocmask(SIG_SETMASK, &mask, NULL);
+  dropsamples(false);
+
+  /* Whole picture goes out with a single write, so it doesn't flicker. */
+  for (char *p = out.data; out.len > 0;) {
+    ssize_t n = write(STDERR_FILENO, p, out.len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      break;
+    p += n, out.len -= n;
+  }
+  free(out.data);
+  return alive;
+}
+
+/* Wait `interval` milliseconds for a key press. The key is consumed. */
+static bool waitkey(int interval) {
+  struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+  uint64_t deadline = stats_clock() + (uint64_t)interval * 1000000;
+
+  for (;;) {
+    uint64_t now = stats_clock();
+    if (now >= deadline)
+      return false;
+    /* SIGCHLD makes it return 0 early, so wait for the rest of time. */
+    if (Poll(&pfd, 1, (deadline - now + 999999) / 1000000) > 0) {
+      char key[64];
+      if (read(STDIN_FILENO, key, sizeof(key)) < 0 && errno == EINTR)
+        continue;
+      return true;
+    }
+  }
+}
+
+int monitorjobs(int interval) {
+  /* Only the terminal's foreground process group may change its modes. */
+  bool tty = isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+  struct termios saved, raw;
+
+  if (tty) {
+    /* Any key stops the monitor, ^C included. */
+    Tcgetattr(STDIN_FILENO, &saved);
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    Tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+  }
+
+  bool clear = tty && isatty(STDERR_FILENO);
+  while (refresh(clear) > 0 && tty && !waitkey(interval))
+    continue;
+
+  if (tty)
+    Tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+  dropsamples(true);
+  return 0;
+}
@@ -3,13 +3,26 @@
 
 #define _GNU_SOURCE
 #include <assert.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <termios.h>
+#include <time.h>
 #include <dlfcn.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "trace.h"
+#include "hist.h"
 
 static int (*execve_p)(const char *path, char *const argv[],
                        char *const envp[]) = NULL;
@@ -22,6 +35,24 @@ static int (*setpgid_p)(pid_t pid, pid_t pgid) = NULL;
 static int (*tcsetpgrp_p)(int fd, pid_t pgrp);
 static int (*tcsetattr_p)(int fd, int action, const struct termios *t);
 static int (*kill_p)(pid_t pid, int sig);
+static int (*pipe_p)(int fds[2]);
+static int (*pipe2_p)(int fds[2], int flags);
+static int (*dup_p)(int fd);
+static int (*dup3_p)(int oldfd, int newfd, int flags);
+static ssize_t (*read_p)(int fd, void *buf, size_t count);
+static ssize_t (*write_p)(int fd, const void *buf, size_t count);
+static int (*posix_spawn_p)(pid_t *pid, const char *path,
+                            const posix_spawn_file_actions_t *file_actions,
+                            const posix_spawnattr_t *attrp,
+                            char *const argv[], char *const envp[]);
+static int (*clone_p)(int (*fn)(void *), void *stack, int flags, void *arg,
+                      ...);
+static pid_t (*wait4_p)(pid_t pid, int *status, int options,
+                        struct rusage *rusage);
+static int (*waitid_p)(idtype_t idtype, id_t id, siginfo_t *infop,
+                       int options);
+static int (*sigprocmask_p)(int how, const sigset_t *set, sigset_t *oldset);
+static int (*sigsuspend_p)(const sigset_t *mask);
 
 static void xdlsym(const char *symbol, void **fn_p) {
   if (*fn_p == NULL) {
@@ -34,115 +65,639 @@ static void xdlsym(const char *symbol, void **fn_p) {
   }
 }
 
-#define LINESZ 256
+/* TRACE_CALLS=fork,execve,... selects intercepted calls that are traced,
+ * TRACE_CALLS=all selects all of them. Other wrappers only pass the call
+ * through. By default the original set of calls is traced. */
+#define DEFAULT_CALLS                                                          \
+  ((1U << TR_EXECVE) | (1U << TR_FORK) | (1U << TR_WAITPID) |                  \
+   (1U << TR_OPEN) | (1U << TR_CLOSE) | (1U << TR_DUP2) |                      \
+   (1U << TR_SETPGID) | (1U << TR_KILL) | (1U << TR_TCSETPGRP) |               \
+   (1U << TR_TCSETATTR))
 
-static __attribute__((format(printf, 1, 2))) void report(const char *fmt, ...) {
-  char line[LINESZ];
-  int n = 0;
+static uint32_t tracemask = DEFAULT_CALLS;
+
+#define TRACED(id) (tracemask & (1U << (id)))
+
+static void select_calls(const char *calls) {
+  char *list = strdup(calls), *saveptr = NULL;
+
+  tracemask = 0;
+  for (char *name = strtok_r(list, ",", &saveptr); name;
+       name = strtok_r(NULL, ",", &saveptr)) {
+    if (!strcmp(name, "all")) {
+      tracemask = (1U << TR_NCALLS) - 1;
+      continue;
+    }
+    int i;
+    for (i = 0; i < TR_NCALLS; i++)
+      if (!strcmp(name, trace_callname[i]))
+        break;
+    if (i < TR_NCALLS)
+      tracemask |= 1U << i;
+    else
+      fprintf(stderr, "trace.so: unknown call '%s'\n", name);
+  }
+  free(list);
+}
+
+/* If TRACE_RING is set, then instead of printing each record to standard
+ * error, append it in binary form to a ring file "$TRACE_RING.<pid>" that is
+ * private to the process. Use tracedump to convert ring files to text. */
+static const char *ring_prefix = NULL;
+static trace_ring_t *ring = NULL;
+static pid_t ring_pid = 0;
+
+#define RINGSZ (sizeof(trace_ring_t) + sizeof(trace_rec_t) * TR_NRECS)
+
+/* If TRACE_HIST is set, then measure how long each intercepted call takes.
+ * Histograms are kept in a file mapped by all traced processes, so parent and
+ * children (also the ones that called execve) aggregate into one table.
+ * The process that created the table prints a summary when it exits. */
+typedef struct trace_hist {
+  pid_t owner;
+  hist_t call[TR_NCALLS];
+} trace_hist_t;
+
+static trace_hist_t *hist = NULL;
+
+static uint64_t now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Evaluate `expr` and record how long it took in histogram for call `id`. */
+#define TIMED(id, expr)                                                        \
+  ({                                                                           \
+    uint64_t _start = hist ? now() : 0;                                        \
+    typeof(expr) _res = (expr);                                                \
+    if (hist)                                                                  \
+      hist_record(&hist->call[id], now() - _start);                            \
+    _res;                                                                      \
+  })
+
+static void hist_open(void) {
+  char path[PATH_MAX];
+  const char *shm = getenv("TRACE_HIST_SHM");
+  bool owner = (shm == NULL);
+
+  if (owner) {
+    snprintf(path, PATH_MAX, "/dev/shm/trace-hist.%d", getpid());
+    setenv("TRACE_HIST_SHM", path, 1);
+    shm = path;
+  }
+
+  xdlsym("open", (void **)&open_p);
+  xdlsym("close", (void **)&close_p);
+
+  /* Only the owner creates the table. If it's gone or not of full size yet,
+   * mapping it would raise SIGBUS on first update, so measuring is off. */
+  int flags = owner ? O_RDWR | O_CREAT | O_CLOEXEC : O_RDWR | O_CLOEXEC;
+  int fd = open_p(shm, flags, 0600);
+  if (fd < 0)
+    return;
+
+  struct stat sb;
+  trace_hist_t *h = MAP_FAILED;
+  if (owner ? ftruncate(fd, sizeof(trace_hist_t)) == 0
+            : fstat(fd, &sb) == 0 && sb.st_size >= (off_t)sizeof(trace_hist_t))
+    h = mmap(NULL, sizeof(trace_hist_t), PROT_READ | PROT_WRITE, MAP_SHARED,
+             fd, 0);
+  close_p(fd);
+  if (h == MAP_FAILED)
+    return;
+
+  if (owner)
+    h->owner = getpid();
+  hist = h;
+}
+
+#define US(ns) ((double)(ns) / 1000.0)
+
+static __attribute__((destructor)) void hist_summary(void) {
+  if (hist == NULL || hist->owner != getpid())
+    return;
+
+  dprintf(STDERR_FILENO, "%-12s %8s %10s %10s %10s\n", "(usec)", "count",
+          "p50", "p99", "max");
+  for (int i = 0; i < TR_NCALLS; i++) {
+    hist_t *h = &hist->call[i];
+    if (h->count == 0)
+      continue;
+    dprintf(STDERR_FILENO, "%-12s %8lu %10.1f %10.1f %10.1f\n",
+            trace_callname[i], h->count, US(hist_percentile(h, 50)),
+            US(hist_percentile(h, 99)), US(h->max));
+  }
+
+  unlink(getenv("TRACE_HIST_SHM"));
+}
+
+static trace_ring_t *ring_open(pid_t pid) {
+  char path[PATH_MAX];
+  snprintf(path, PATH_MAX, "%s.%d", ring_prefix, pid);
+
+  xdlsym("open", (void **)&open_p);
+  xdlsym("close", (void **)&close_p);
+
+  /* Process may already have a ring file if it has just called execve. */
+  int fd = open_p(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return NULL;
+
+  trace_ring_t *r = MAP_FAILED;
+  if (ftruncate(fd, RINGSZ) == 0)
+    r = mmap(NULL, RINGSZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close_p(fd);
+  if (r == MAP_FAILED)
+    return NULL;
+
+  if (r->magic != TR_MAGIC) {
+    r->magic = TR_MAGIC;
+    r->recsz = sizeof(trace_rec_t);
+    r->nrecs = TR_NRECS;
+    r->head = 0;
+  }
+  return r;
+}
+
+static bool ring_append(trace_rec_t *r) {
+  /* Child processes inherit parent's ring, but must use their own. */
+  if (ring_pid != r->pid) {
+    ring = ring_open(r->pid);
+    ring_pid = r->pid;
+  }
+  if (ring == NULL) {
+    /* Could not create ring file, so fall back to text output. */
+    ring_prefix = NULL;
+    return false;
+  }
+  uint64_t seq = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+  ring->rec[seq % TR_NRECS] = *r;
+  return true;
+}
+
+#define LINESZ (256 + PATH_MAX) /* room for a whole path */
+
+/* If TRACE_CHROME names a file, then all traced processes append Chrome
+ * trace-event JSON there (load it in chrome://tracing or Perfetto UI).
+ * Each process gets its own track, sorted by process group. A process is
+ * shown as a span from fork to execve followed by a span from execve till
+ * its parent reaps it. Each traced call is an instant event. Timestamps come
+ * from CLOCK_MONOTONIC, so they are comparable across processes. */
+static int chrome_fd = -1;
+static pid_t chrome_pid = 0; /* process that has its track named already */
+
+static void chrome_write(const char *fmt, ...) {
+  char line[LINESZ * 2];
   va_list args;
   va_start(args, fmt);
-  n += snprintf(line + n, LINESZ - n, "[%d:%d] ", getpid(), getpgrp());
-  n += vsnprintf(line + n, LINESZ - n, fmt, args);
-  assert(n < LINESZ); /* Need one character to terminate string! */
-  line[n++] = '\n';
+  int n = vsnprintf(line, sizeof(line), fmt, args);
   va_end(args);
-  int m = write(STDERR_FILENO, line, n);
+  if (n < 0 || n >= (int)sizeof(line))
+    return;
+  xdlsym("write", (void **)&write_p);
+  (void)write_p(chrome_fd, line, n); /* O_APPEND makes it atomic */
+}
+
+#define TS(t) (t) / 1000, (t) % 1000
+
+static void chrome_name(pid_t pid, pid_t pgid) {
+  chrome_write("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,"
+               "\"args\":{\"name\":\"pgrp %d: pid %d\"}},\n",
+               pid, pgid, pid);
+  chrome_write("{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%d,"
+               "\"args\":{\"sort_index\":%d}},\n",
+               pid, pgid);
+}
+
+static void chrome_span(char ph, pid_t pid, uint64_t time, const char *name) {
+  chrome_write("{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+               "\"ts\":%lu.%03lu},\n",
+               ph, name, pid, pid, TS(time));
+}
+
+static void chrome_event(trace_rec_t *r, const char *path) {
+  char text[LINESZ], name[LINESZ * 2];
+  bool named = chrome_pid == r->pid;
+
+  if (!named) {
+    chrome_name(r->pid, r->pgid);
+    chrome_pid = r->pid;
+  }
+
+  switch (r->call) {
+    case TR_FORK:
+    case TR_VFORK:
+      if (r->result > 0) {
+        chrome_name(r->result, r->pgid);
+        chrome_span('B', r->result, r->time, "fork");
+      }
+      break;
+    case TR_WAITPID:
+    case TR_WAIT4:
+      if (r->result > 0 && (WIFEXITED(r->arg[1]) || WIFSIGNALED(r->arg[1])))
+        chrome_span('E', r->result, r->time, "");
+      break;
+    case TR_SETPGID:
+      if (r->result == 0 && r->arg[0] != 0 && r->arg[0] != r->pid)
+        chrome_name(r->arg[0], r->arg[1] ? r->arg[1] : r->arg[0]);
+      else if (r->result == 0 && named)
+        chrome_name(r->pid, r->pgid);
+      break;
+    default:
+      break;
+  }
+
+  /* Use text representation of the call without "[pid:pgid] " prefix. */
+  if (trace_format_path(text, LINESZ, r, path) < 0)
+    return;
+  char *t = strchr(text, ' ');
+  int n = 0;
+  for (t = t ? t + 1 : text; *t && *t != '\n'; t++) {
+    if (*t == '"' || *t == '\\')
+      name[n++] = '\\';
+    name[n++] = *t;
+  }
+  name[n] = '\0';
+
+  chrome_write("{\"ph\":\"i\",\"s\":\"t\",\"name\":\"%s\",\"cat\":\"%s\","
+               "\"pid\":%d,\"tid\":%d,\"ts\":%lu.%03lu},\n",
+               name, trace_callname[r->call], r->pid, r->pid, TS(r->time));
+}
+
+static void chrome_open(const char *path) {
+  bool root = getenv("TRACE_CHROME_ROOT") == NULL;
+  int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+
+  xdlsym("open", (void **)&open_p);
+  if ((chrome_fd = open_p(path, root ? flags | O_TRUNC : flags, 0644)) < 0)
+    return;
+
+  if (root) {
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", getpid());
+    setenv("TRACE_CHROME_ROOT", pid, 1);
+    /* Closing bracket is optional in JSON Array Format. */
+    chrome_write("[\n");
+  } else {
+    /* We have just called execve, so the span started by fork ends here. */
+    uint64_t time = now();
+    chrome_name(getpid(), getpgrp());
+    chrome_pid = getpid();
+    chrome_span('E', getpid(), time, "");
+    chrome_span('B', getpid(), time, program_invocation_short_name);
+  }
+}
+
+static __attribute__((constructor)) void trace_init(void) {
+  const char *calls = getenv("TRACE_CALLS");
+  if (calls)
+    select_calls(calls);
+  ring_prefix = getenv("TRACE_RING");
+  if (getenv("TRACE_HIST"))
+    hist_open();
+  const char *chrome = getenv("TRACE_CHROME");
+  if (chrome)
+    chrome_open(chrome);
+}
+
+/* Text output shows `str` as the path argument. Records in the ring keep
+ * only a prefix of it in `r->str`. */
+static void emit(trace_rec_t *r, const char *str) {
+  if (r->time == 0)
+    r->time = now();
+  r->pid = getpid();
+  r->pgid = getpgrp();
+
+  if (chrome_fd >= 0) {
+    chrome_event(r, str);
+    return;
+  }
+
+  if (ring_prefix && ring_append(r))
+    return;
+
+  char line[LINESZ];
+  int n = trace_format_path(line, LINESZ, r, str);
+  assert(n > 0); /* Need one character to terminate string! */
+  xdlsym("write", (void **)&write_p);
+  int m = write_p(STDERR_FILENO, line, n);
   assert(m == n); /* Fail if write was not atomic! */
 }
 
+static void report(trace_rec_t *r) {
+  emit(r, r->str);
+}
+
+/* For calls that take a path. */
+static void report_path(trace_rec_t *r, const char *path) {
+  if (path == NULL)
+    path = "(null)";
+  size_t len = strlen(path);
+  if (len < TR_STRSZ) {
+    memcpy(r->str, path, len + 1);
+  } else {
+    memcpy(r->str, path, TR_STRSZ - 4);
+    strcpy(r->str + TR_STRSZ - 4, "...");
+  }
+  emit(r, path);
+}
+
+#define REC(c, ...)                                                            \
+  (trace_rec_t) {                                                              \
+    .call = (c), .arg = {__VA_ARGS__}                                          \
+  }
+
+#define ARG(x) ((int64_t)(intptr_t)(x))
+
 int execve(const char *path, char *const argv[], char *const envp[]) {
   xdlsym("execve", (void **)&execve_p);
-  report("execve(\"%s\", %p, %p)", path, argv, envp);
-  return execve_p(path, argv, envp);
+  if (!TRACED(TR_EXECVE))
+    return execve_p(path, argv, envp);
+  trace_rec_t r = REC(TR_EXECVE, 0, ARG(argv), ARG(envp));
+  report_path(&r, path);
+  return TIMED(TR_EXECVE, execve_p(path, argv, envp));
 }
 
 int fork(void) {
   xdlsym("fork", (void **)&fork_p);
+  if (!TRACED(TR_FORK))
+    return fork_p();
+  uint64_t start = now();
   pid_t child = fork_p();
-  if (child)
-    report("fork() = %d", child);
+  if (child && hist)
+    hist_record(&hist->call[TR_FORK], now() - start);
+  if (child) {
+    trace_rec_t r = REC(TR_FORK);
+    r.time = start;
+    r.result = child;
+    report(&r);
+  }
   return child;
 }
 
-#define _SN(x) [x] = #x
+/* Wrapping vfork is not possible, since the child would return from this
+ * function and destroy its stack frame that is shared with the parent.
+ * vfork is allowed to behave like fork, so that's what we do. */
+pid_t vfork(void) {
+  xdlsym("fork", (void **)&fork_p);
+  if (!TRACED(TR_VFORK))
+    return fork_p();
+  pid_t child = TIMED(TR_VFORK, fork_p());
+  if (child) {
+    trace_rec_t r = REC(TR_VFORK);
+    r.result = child;
+    report(&r);
+  }
+  return child;
+}
 
-static const char *signame[NSIG] = {
-  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
-  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
-  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
-  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
-  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
-  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+int clone(int (*fn)(void *), void *stack, int flags, void *arg, ...) {
+  va_list args;
+  va_start(args, arg);
+  pid_t *parent_tid = va_arg(args, pid_t *);
+  void *tls = va_arg(args, void *);
+  pid_t *child_tid = va_arg(args, pid_t *);
+  va_end(args);
 
-#undef _SN
+  xdlsym("clone", (void **)&clone_p);
+  if (!TRACED(TR_CLONE))
+    return clone_p(fn, stack, flags, arg, parent_tid, tls, child_tid);
+  int res = TIMED(TR_CLONE, clone_p(fn, stack, flags, arg, parent_tid, tls,
+                                    child_tid));
+  trace_rec_t r = REC(TR_CLONE, flags);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int posix_spawn(pid_t *pid, const char *path,
+                const posix_spawn_file_actions_t *file_actions,
+                const posix_spawnattr_t *attrp, char *const argv[],
+                char *const envp[]) {
+  xdlsym("posix_spawn", (void **)&posix_spawn_p);
+  if (!TRACED(TR_POSIX_SPAWN))
+    return posix_spawn_p(pid, path, file_actions, attrp, argv, envp);
+  pid_t child = -1;
+  int res = TIMED(TR_POSIX_SPAWN, posix_spawn_p(&child, path, file_actions,
+                                                attrp, argv, envp));
+  if (pid)
+    *pid = child;
+  trace_rec_t r = REC(TR_POSIX_SPAWN, res ? -1 : child);
+  r.result = res;
+  report_path(&r, path);
+  return res;
+}
 
 pid_t waitpid(pid_t pid, int *statusp, int options) {
-  int status;
+  int status = 0;
   xdlsym("waitpid", (void **)&waitpid_p);
-  pid = waitpid_p(pid, &status, options);
-  if (pid <= 0) {
-    report("waitpid(...) -> {}");
-  } else if (WIFCONTINUED(status)) {
-    report("waitpid(...) -> {pid=%d, status=SIGCONT}", pid);
-  } else if (WIFSTOPPED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WSTOPSIG(status)]);
-  } else if (WIFSIGNALED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%s}", pid,
-           signame[WTERMSIG(status)]);
-  } else if (WIFEXITED(status)) {
-    report("waitpid(...) -> {pid=%d, status=%d}", pid, WEXITSTATUS(status));
-  }
+  if (!TRACED(TR_WAITPID))
+    return waitpid_p(pid, statusp, options);
+  trace_rec_t r = REC(TR_WAITPID, pid, 0, options);
+  r.result = pid = TIMED(TR_WAITPID, waitpid_p(pid, &status, options));
+  r.arg[1] = status;
+  report(&r);
   if (statusp)
     *statusp = status;
   return pid;
 }
 
-int open(const char *pathname, int flags, mode_t mode) {
+pid_t wait4(pid_t pid, int *statusp, int options, struct rusage *rusage) {
+  int status = 0;
+  xdlsym("wait4", (void **)&wait4_p);
+  if (!TRACED(TR_WAIT4))
+    return wait4_p(pid, statusp, options, rusage);
+  trace_rec_t r = REC(TR_WAIT4, pid, 0, options);
+  r.result = pid = TIMED(TR_WAIT4, wait4_p(pid, &status, options, rusage));
+  r.arg[1] = status;
+  report(&r);
+  if (statusp)
+    *statusp = status;
+  return pid;
+}
+
+int waitid(idtype_t idtype, id_t id, siginfo_t *infop, int options) {
+  xdlsym("waitid", (void **)&waitid_p);
+  if (!TRACED(TR_WAITID))
+    return waitid_p(idtype, id, infop, options);
+  int res = TIMED(TR_WAITID, waitid_p(idtype, id, infop, options));
+  trace_rec_t r = REC(TR_WAITID, idtype, id, options);
+  if (res == 0 && infop) {
+    r.arg[3] = ((int64_t)infop->si_pid << 32) | (uint32_t)infop->si_status;
+    r.aux = infop->si_code;
+  }
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int open(const char *pathname, int flags, ...) {
+  va_list args;
+  va_start(args, flags);
+  mode_t mode = va_arg(args, mode_t);
+  va_end(args);
+
   xdlsym("open", (void **)&open_p);
-  int res = open_p(pathname, flags, mode);
-  report("open(\"%s\", %d, %d) = %d", pathname, flags, mode, res);
+  if (!TRACED(TR_OPEN))
+    return open_p(pathname, flags, mode);
+  int res = TIMED(TR_OPEN, open_p(pathname, flags, mode));
+  trace_rec_t r = REC(TR_OPEN, 0, flags, mode);
+  r.result = res;
+  report_path(&r, pathname);
   return res;
 }
 
 int close(int fd) {
   xdlsym("close", (void **)&close_p);
-  int res = close_p(fd);
-  report("close(%d) = %d", fd, res);
+  if (!TRACED(TR_CLOSE))
+    return close_p(fd);
+  int res = TIMED(TR_CLOSE, close_p(fd));
+  trace_rec_t r = REC(TR_CLOSE, fd);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int pipe(int fds[2]) {
+  xdlsym("pipe", (void **)&pipe_p);
+  if (!TRACED(TR_PIPE))
+    return pipe_p(fds);
+  int res = TIMED(TR_PIPE, pipe_p(fds));
+  trace_rec_t r = REC(TR_PIPE, res ? -1 : fds[0], res ? -1 : fds[1]);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int pipe2(int fds[2], int flags) {
+  xdlsym("pipe2", (void **)&pipe2_p);
+  if (!TRACED(TR_PIPE2))
+    return pipe2_p(fds, flags);
+  int res = TIMED(TR_PIPE2, pipe2_p(fds, flags));
+  trace_rec_t r = REC(TR_PIPE2, res ? -1 : fds[0], res ? -1 : fds[1], flags);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int dup(int fd) {
+  xdlsym("dup", (void **)&dup_p);
+  if (!TRACED(TR_DUP))
+    return dup_p(fd);
+  int res = TIMED(TR_DUP, dup_p(fd));
+  trace_rec_t r = REC(TR_DUP, fd);
+  r.result = res;
+  report(&r);
   return res;
 }
 
 int dup2(int oldfd, int newfd) {
   xdlsym("dup2", (void **)&dup2_p);
-  int res = dup2_p(oldfd, newfd);
-  report("dup2(%d, %d) = %d", oldfd, newfd, res);
+  if (!TRACED(TR_DUP2))
+    return dup2_p(oldfd, newfd);
+  int res = TIMED(TR_DUP2, dup2_p(oldfd, newfd));
+  trace_rec_t r = REC(TR_DUP2, oldfd, newfd);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+  xdlsym("dup3", (void **)&dup3_p);
+  if (!TRACED(TR_DUP3))
+    return dup3_p(oldfd, newfd, flags);
+  int res = TIMED(TR_DUP3, dup3_p(oldfd, newfd, flags));
+  trace_rec_t r = REC(TR_DUP3, oldfd, newfd, flags);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+ssize_t read(int fd, void *buf, size_t count) {
+  xdlsym("read", (void **)&read_p);
+  if (!TRACED(TR_READ))
+    return read_p(fd, buf, count);
+  ssize_t res = TIMED(TR_READ, read_p(fd, buf, count));
+  trace_rec_t r = REC(TR_READ, fd, count);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+  xdlsym("write", (void **)&write_p);
+  if (!TRACED(TR_WRITE))
+    return write_p(fd, buf, count);
+  ssize_t res = TIMED(TR_WRITE, write_p(fd, buf, count));
+  trace_rec_t r = REC(TR_WRITE, fd, count);
+  r.result = res;
+  report(&r);
   return res;
 }
 
 int setpgid(pid_t pid, pid_t pgid) {
   xdlsym("setpgid", (void **)&setpgid_p);
-  int res = setpgid_p(pid, pgid);
-  report("setpgid(%d, %d) = %d", pid, pgid, res);
+  if (!TRACED(TR_SETPGID))
+    return setpgid_p(pid, pgid);
+  int res = TIMED(TR_SETPGID, setpgid_p(pid, pgid));
+  trace_rec_t r = REC(TR_SETPGID, pid, pgid);
+  r.result = res;
+  report(&r);
   return res;
 }
 
 int kill(pid_t pid, int sig) {
   xdlsym("kill", (void **)&kill_p);
-  int res = kill_p(pid, sig);
-  report("kill(%d, %s) = %d", pid, signame[sig], res);
+  if (!TRACED(TR_KILL))
+    return kill_p(pid, sig);
+  int res = TIMED(TR_KILL, kill_p(pid, sig));
+  trace_rec_t r = REC(TR_KILL, pid, sig);
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int sigprocmask(int how, const sigset_t *set, sigset_t *oldset) {
+  xdlsym("sigprocmask", (void **)&sigprocmask_p);
+  if (!TRACED(TR_SIGPROCMASK))
+    return sigprocmask_p(how, set, oldset);
+  int res = TIMED(TR_SIGPROCMASK, sigprocmask_p(how, set, oldset));
+  trace_rec_t r = REC(TR_SIGPROCMASK, how, ARG(set), ARG(oldset));
+  r.result = res;
+  report(&r);
+  return res;
+}
+
+int sigsuspend(const sigset_t *mask) {
+  xdlsym("sigsuspend", (void **)&sigsuspend_p);
+  if (!TRACED(TR_SIGSUSPEND))
+    return sigsuspend_p(mask);
+  int res = TIMED(TR_SIGSUSPEND, sigsuspend_p(mask));
+  trace_rec_t r = REC(TR_SIGSUSPEND, ARG(mask));
+  r.result = res;
+  report(&r);
   return res;
 }
 
 int tcsetpgrp(int fd, pid_t pgrp) {
   xdlsym("tcsetpgrp", (void **)&tcsetpgrp_p);
-  int res = tcsetpgrp_p(fd, pgrp);
-  report("tcsetpgrp(%d, %d) = %d", fd, pgrp, res);
+  if (!TRACED(TR_TCSETPGRP))
+    return tcsetpgrp_p(fd, pgrp);
+  int res = TIMED(TR_TCSETPGRP, tcsetpgrp_p(fd, pgrp));
+  trace_rec_t r = REC(TR_TCSETPGRP, fd, pgrp);
+  r.result = res;
+  report(&r);
   return res;
 }
 
 int tcsetattr(int fd, int action, const struct termios *t) {
   xdlsym("tcsetattr", (void **)&tcsetattr_p);
-  int res = tcsetattr_p(fd, action, t);
-  report("tcsetattr(%d, %d, %p) = %d", fd, action, t, res);
+  if (!TRACED(TR_TCSETATTR))
+    return tcsetattr_p(fd, action, t);
+  int res = TIMED(TR_TCSETATTR, tcsetattr_p(fd, action, t));
+  trace_rec_t r = REC(TR_TCSETATTR, fd, action, ARG(t));
+  r.result = res;
+  report(&r);
   return res;
 }
@@ -0,0 +1,80 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Identifiers of calls intercepted by trace.so */
+enum {
+  TR_EXECVE,
+  TR_FORK,
+  TR_WAITPID,
+  TR_OPEN,
+  TR_CLOSE,
+  TR_DUP2,
+  TR_SETPGID,
+  TR_KILL,
+  TR_TCSETPGRP,
+  TR_TCSETATTR,
+  TR_PIPE,
+  TR_PIPE2,
+  TR_DUP,
+  TR_DUP3,
+  TR_READ,
+  TR_WRITE,
+  TR_POSIX_SPAWN,
+  TR_VFORK,
+  TR_CLONE,
+  TR_WAIT4,
+  TR_WAITID,
+  TR_SIGPROCMASK,
+  TR_SIGSUSPEND,
+  TR_NCALLS
+};
+
+#define TR_STRSZ 64
+
+/* Binary trace record. Scalar arguments are stored in the order of function
+ * parameters, with following exceptions:
+ *  - waitpid & wait4: `arg[1]` holds the status,
+ *  - waitid: `arg[3]` holds `si_pid` and `si_status`, `aux` holds `si_code`,
+ *  - pipe & pipe2: `arg[0]` and `arg[1]` hold created descriptors,
+ *  - posix_spawn: `arg[0]` holds child's pid. */
+typedef struct trace_rec {
+  uint64_t time;       /* CLOCK_MONOTONIC timestamp in nanoseconds */
+  int32_t pid;         /* caller's process identifier */
+  int32_t pgid;        /* caller's process group */
+  int32_t call;        /* one of TR_* */
+  int32_t aux;         /* call specific extra value */
+  int64_t arg[4];      /* scalar arguments */
+  int64_t result;      /* value returned by the call */
+  char str[TR_STRSZ];  /* path argument, ends with "..." if truncated */
+} trace_rec_t;
+
+#define TR_MAGIC 0x474e495243415254ULL /* "TRACRING" */
+#define TR_NRECS 65536
+
+/* Ring file starts with header padded to the size of a single record.
+ * Records are stored at position `seq % nrecs`, so when `head` exceeds
+ * `nrecs` only the last `nrecs` records are available. */
+typedef struct trace_ring {
+  uint64_t magic;   /* TR_MAGIC */
+  uint32_t recsz;   /* sizeof(trace_rec_t) */
+  uint32_t nrecs;   /* number of record slots */
+  uint64_t head;    /* number of records ever written */
+  char _pad[sizeof(trace_rec_t) - 24];
+  trace_rec_t rec[];
+} trace_ring_t;
+
+extern const char *trace_callname[TR_NCALLS];
+
+/* Formats the record exactly as trace.so does in text mode, including
+ * trailing newline. Returns the number of characters written. */
+int trace_format(char *buf, size_t size, const trace_rec_t *r);
+
+/* Same, but shows `path` in place of `str` of the record, which holds only
+ * a prefix of a long path. */
+int trace_format_path(char *buf, size_t size, const trace_rec_t *r,
+                      const char *path);
+
+#endif /* !_TRACE_H_ */
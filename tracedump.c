@@ -0,0 +1,86 @@
+/* Converts binary ring files written by trace.so (TRACE_RING=prefix) into
+ * the same text format that trace.so prints to standard error.
+ *
+ * Usage: tracedump prefix.<pid>...
+ *
+ * Records from all files are merged in timestamp order. */
+
+#include "csapp.h"
+#include "trace.h"
+
+typedef struct source {
+  trace_ring_t *ring; /* mapped ring file */
+  uint64_t next;      /* sequence number of next record to print */
+  uint64_t head;      /* sequence number past the last record */
+} source_t;
+
+static trace_rec_t *current(source_t *src) {
+  if (src->next == src->head)
+    return NULL;
+  return &src->ring->rec[src->next % src->ring->nrecs];
+}
+
+static bool load(source_t *src, const char *path) {
+  int fd = Open(path, O_RDONLY, 0);
+  struct stat sb;
+  Fstat(fd, &sb);
+
+  if ((size_t)sb.st_size < sizeof(trace_ring_t)) {
+    Close(fd);
+    return false;
+  }
+
+  trace_ring_t *ring = Mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  Close(fd);
+
+  if (ring->magic != TR_MAGIC || ring->recsz != sizeof(trace_rec_t) ||
+      sizeof(trace_ring_t) + (size_t)ring->nrecs * ring->recsz >
+        (size_t)sb.st_size) {
+    Munmap(ring, sb.st_size);
+    return false;
+  }
+
+  src->ring = ring;
+  src->head = ring->head;
+  /* Older records have already been overwritten. */
+  src->next = src->head > ring->nrecs ? src->head - ring->nrecs : 0;
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2)
+    app_error("Usage: %s ring-file...", argv[0]);
+
+  int nsrc = 0;
+  source_t *src = Calloc(argc - 1, sizeof(source_t));
+
+  for (int i = 1; i < argc; i++) {
+    if (load(&src[nsrc], argv[i]))
+      nsrc++;
+    else
+      fprintf(stderr, "%s: not a trace ring file\n", argv[i]);
+  }
+
+  char line[MAXLINE];
+
+  for (;;) {
+    source_t *first = NULL;
+
+    for (int i = 0; i < nsrc; i++) {
+      trace_rec_t *r = current(&src[i]);
+      if (r && (first == NULL || r->time < current(first)->time))
+        first = &src[i];
+    }
+
+    if (first == NULL)
+      break;
+
+    int n = trace_format(line, MAXLINE, current(first));
+    if (n > 0)
+      Write(STDOUT_FILENO, line, n);
+    first->next++;
+  }
+
+  free(src);
+  return 0;
+}
@@ -0,0 +1,154 @@
+/* Text representation of trace.so records shared with tracedump. */
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include "trace.h"
+
+const char *trace_callname[TR_NCALLS] = {
+  [TR_EXECVE] = "execve",   [TR_FORK] = "fork",
+  [TR_WAITPID] = "waitpid", [TR_OPEN] = "open",
+  [TR_CLOSE] = "close",     [TR_DUP2] = "dup2",
+  [TR_SETPGID] = "setpgid", [TR_KILL] = "kill",
+  [TR_TCSETPGRP] = "tcsetpgrp", [TR_TCSETATTR] = "tcsetattr",
+  [TR_PIPE] = "pipe",       [TR_PIPE2] = "pipe2",
+  [TR_DUP] = "dup",         [TR_DUP3] = "dup3",
+  [TR_READ] = "read",       [TR_WRITE] = "write",
+  [TR_POSIX_SPAWN] = "posix_spawn", [TR_VFORK] = "vfork",
+  [TR_CLONE] = "clone",     [TR_WAIT4] = "wait4",
+  [TR_WAITID] = "waitid",   [TR_SIGPROCMASK] = "sigprocmask",
+  [TR_SIGSUSPEND] = "sigsuspend",
+};
+
+#define _SN(x) [x] = #x
+
+static const char *signame[NSIG] = {
+  _SN(SIGHUP),  _SN(SIGINT),  _SN(SIGQUIT), _SN(SIGILL),  _SN(SIGTRAP),
+  _SN(SIGABRT), _SN(SIGFPE),  _SN(SIGKILL), _SN(SIGBUS),  _SN(SIGSYS),
+  _SN(SIGSEGV), _SN(SIGPIPE), _SN(SIGALRM), _SN(SIGTERM), _SN(SIGURG),
+  _SN(SIGSTOP), _SN(SIGTSTP), _SN(SIGCONT), _SN(SIGCHLD), _SN(SIGTTIN),
+  _SN(SIGTTOU), _SN(SIGPOLL), _SN(SIGXCPU), _SN(SIGXFSZ), _SN(SIGVTALRM),
+  _SN(SIGPROF), _SN(SIGUSR1), _SN(SIGUSR2), _SN(SIGWINCH)};
+
+#undef _SN
+
+#define P(x) ((void *)(intptr_t)(x))
+#define I(x) ((int)(x))
+
+/* Used for both waitpid and wait4. */
+static int format_wait(char *buf, size_t size, const trace_rec_t *r) {
+  const char *name = trace_callname[r->call];
+  int pid = r->result, status = r->arg[1];
+
+  if (pid <= 0)
+    return snprintf(buf, size, "%s(...) -> {}", name);
+  if (WIFCONTINUED(status))
+    return snprintf(buf, size, "%s(...) -> {pid=%d, status=SIGCONT}", name,
+                    pid);
+  if (WIFSTOPPED(status))
+    return snprintf(buf, size, "%s(...) -> {pid=%d, status=%s}", name, pid,
+                    signame[WSTOPSIG(status)]);
+  if (WIFSIGNALED(status))
+    return snprintf(buf, size, "%s(...) -> {pid=%d, status=%s}", name, pid,
+                    signame[WTERMSIG(status)]);
+  if (WIFEXITED(status))
+    return snprintf(buf, size, "%s(...) -> {pid=%d, status=%d}", name, pid,
+                    WEXITSTATUS(status));
+  return -1;
+}
+
+static int format_waitid(char *buf, size_t size, const trace_rec_t *r) {
+  const int64_t *a = r->arg;
+  int pid = a[3] >> 32, status = (int32_t)a[3];
+
+  if (r->result < 0 || pid == 0)
+    return snprintf(buf, size, "waitid(%d, %d, %d) = %d -> {}", I(a[0]),
+                    I(a[1]), I(a[2]), I(r->result));
+  return snprintf(buf, size,
+                  "waitid(%d, %d, %d) = %d -> {pid=%d, code=%d, status=%d}",
+                  I(a[0]), I(a[1]), I(a[2]), I(r->result), pid, r->aux,
+                  status);
+}
+
+static int format_call(char *buf, size_t size, const trace_rec_t *r,
+                       const char *str) {
+  const int64_t *a = r->arg;
+  int res = r->result;
+
+  switch (r->call) {
+    case TR_EXECVE:
+      return snprintf(buf, size, "execve(\"%s\", %p, %p)", str, P(a[1]),
+                      P(a[2]));
+    case TR_FORK:
+      return snprintf(buf, size, "fork() = %d", res);
+    case TR_WAITPID:
+    case TR_WAIT4:
+      return format_wait(buf, size, r);
+    case TR_WAITID:
+      return format_waitid(buf, size, r);
+    case TR_OPEN:
+      return snprintf(buf, size, "open(\"%s\", %d, %d) = %d", str, I(a[1]),
+                      I(a[2]), res);
+    case TR_CLOSE:
+      return snprintf(buf, size, "close(%d) = %d", I(a[0]), res);
+    case TR_DUP2:
+      return snprintf(buf, size, "dup2(%d, %d) = %d", I(a[0]), I(a[1]), res);
+    case TR_SETPGID:
+      return snprintf(buf, size, "setpgid(%d, %d) = %d", I(a[0]), I(a[1]),
+                      res);
+    case TR_KILL:
+      return snprintf(buf, size, "kill(%d, %s) = %d", I(a[0]), signame[a[1]],
+                      res);
+    case TR_TCSETPGRP:
+      return snprintf(buf, size, "tcsetpgrp(%d, %d) = %d", I(a[0]), I(a[1]),
+                      res);
+    case TR_TCSETATTR:
+      return snprintf(buf, size, "tcsetattr(%d, %d, %p) = %d", I(a[0]),
+                      I(a[1]), P(a[2]), res);
+    case TR_PIPE:
+      return snprintf(buf, size, "pipe([%d, %d]) = %d", I(a[0]), I(a[1]), res);
+    case TR_PIPE2:
+      return snprintf(buf, size, "pipe2([%d, %d], %d) = %d", I(a[0]), I(a[1]),
+                      I(a[2]), res);
+    case TR_DUP:
+      return snprintf(buf, size, "dup(%d) = %d", I(a[0]), res);
+    case TR_DUP3:
+      return snprintf(buf, size, "dup3(%d, %d, %d) = %d", I(a[0]), I(a[1]),
+                      I(a[2]), res);
+    case TR_READ:
+    case TR_WRITE:
+      return snprintf(buf, size, "%s(%d, %ld) = %ld", trace_callname[r->call],
+                      I(a[0]), (long)a[1], (long)r->result);
+    case TR_POSIX_SPAWN:
+      return snprintf(buf, size, "posix_spawn(\"%s\") = %d -> {pid=%d}",
+                      str, res, I(a[0]));
+    case TR_VFORK:
+      return snprintf(buf, size, "vfork() = %d", res);
+    case TR_CLONE:
+      return snprintf(buf, size, "clone(%#x) = %d", I(a[0]), res);
+    case TR_SIGPROCMASK:
+      return snprintf(buf, size, "sigprocmask(%d, %p, %p) = %d", I(a[0]),
+                      P(a[1]), P(a[2]), res);
+    case TR_SIGSUSPEND:
+      return snprintf(buf, size, "sigsuspend(%p) = %d", P(a[0]), res);
+    default:
+      return -1;
+  }
+}
+
+int trace_format(char *buf, size_t size, const trace_rec_t *r) {
+  return trace_format_path(buf, size, r, r->str);
+}
+
+int trace_format_path(char *buf, size_t size, const trace_rec_t *r,
+                      const char *path) {
+  int n = snprintf(buf, size, "[%d:%d] ", r->pid, r->pgid);
+  int m = format_call(buf + n, size - n, r, path);
+  if (m < 0 || (size_t)(n + m + 1) >= size)
+    return -1; /* Need one character to terminate string! */
+  n += m;
+  buf[n++] = '\n';
+  buf[n] = '\0';
+  return n;
+}
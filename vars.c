@@ -0,0 +1,343 @@
+#include "shell.h"
+
+/* Shell variables are kept in a hash table with chaining, keyed with
+ * Jenkins' one-at-a-time hash of the name. Each variable is a single
+ * "NAME=value" string, so the environment of subprocesses is just an array of
+ * pointers to strings of exported variables. The array is rebuilt only after
+ * an exported variable has changed and `environ` is pointed at it, so
+ * `getenv` agrees with us. Until then it may point to strings of variables
+ * that were changed, so these are freed only after the rebuild. */
+
+typedef struct var {
+  struct var *next; /* next variable in the same bucket */
+  uint32_t hash;    /* hash of the name */
+  size_t namelen;   /* length of the name */
+  bool exported;    /* passed to subprocesses */
+  char *str;        /* "NAME=value" */
+} var_t;
+
+static var_t **bucket = NULL;
+static unsigned nbucket = 0; /* power of two */
+static unsigned nvars = 0;
+static unsigned nexported = 0;
+
+static char **envp = NULL; /* environment for subprocesses */
+static bool dirty = true;  /* `envp` has to be rebuilt */
+static char **stale = NULL; /* strings that `envp` may still point to */
+static unsigned nstale = 0, stalecap = 0;
+
+static char status[16] = "0"; /* value of $? */
+static char shellpid[16];     /* value of $$ */
+
+/* Names aren't NUL-terminated within "NAME=value" strings, so they're hashed
+ * byte by byte up to `len`. */
+static uint32_t hash(const char *name, size_t len) {
+  uint32_t h = 0;
+  for (size_t i = 0; i < len; i++) {
+    h += (uint8_t)name[i];
+    h += h << 10;
+    h ^= h >> 6;
+  }
+  h += h << 3;
+  h ^= h >> 11;
+  h += h << 15;
+  return h;
+}
+
+/* Frees the string of a variable that is changed or removed. */
+static void dropstr(var_t *v) {
+  if (!v->exported || envp == NULL) {
+    free(v->str);
+    return;
+  }
+  if (nstale == stalecap) {
+    stalecap = stalecap ? stalecap * 2 : 16;
+    stale = realloc(stale, sizeof(char *) * stalecap);
+  }
+  stale[nstale++] = v->str;
+}
+
+static void rehash(void);
+
+static var_t **lookup(const char *name, size_t len, uint32_t h) {
+  if (nbucket == 0)
+    rehash();
+
+  var_t **vp = &bucket[h & (nbucket - 1)];
+  for (; *vp; vp = &(*vp)->next) {
+    var_t *v = *vp;
+    if (v->hash == h && v->namelen == len && !strncmp(v->str, name, len))
+      break;
+  }
+  return vp;
+}
+
+static void rehash(void) {
+  var_t **old = bucket;
+  unsigned oldn = nbucket;
+
+  nbucket = nbucket ? nbucket * 2 : 64;
+  bucket = calloc(nbucket, sizeof(var_t *));
+  for (unsigned i = 0; i < oldn; i++) {
+    for (var_t *v = old[i], *next; v; v = next) {
+      next = v->next;
+      v->next = bucket[v->hash & (nbucket - 1)];
+      bucket[v->hash & (nbucket - 1)] = v;
+    }
+  }
+  free(old);
+}
+
+/* Length of a valid variable name at the beginning of `s`. */
+static size_t namelen(const char *s) {
+  size_t n = 0;
+  if (isalpha(s[0]) || s[0] == '_')
+    for (n = 1; isalnum(s[n]) || s[n] == '_'; n++)
+      continue;
+  return n;
+}
+
+const char *getvarn(const char *name, size_t len) {
+  var_t *v = *lookup(name, len, hash(name, len));
+  return v ? v->str + len + 1 : NULL;
+}
+
+const char *getvar(const char *name) {
+  return getvarn(name, strlen(name));
+}
+
+/* Sets variable `name` (of length `len`) to `value`. Variable becomes exported
+ * if requested, otherwise it keeps its current status. */
+static void setvarn(const char *name, size_t len, const char *value,
+                    bool export) {
+  uint32_t h = hash(name, len);
+  var_t **vp = lookup(name, len, h);
+  var_t *v = *vp;
+
+  if (v == NULL) {
+    if (nvars >= nbucket) {
+      rehash();
+      vp = lookup(name, len, h);
+    }
+    v = *vp = calloc(1, sizeof(var_t));
+    v->hash = h;
+    v->namelen = len;
+    nvars++;
+    if (value == NULL)
+      value = "";
+  } else if (value == NULL) {
+    /* Only exporting existing variable. */
+    value = v->str + len + 1;
+  }
+
+  if (value) {
+    char *str = malloc(len + strlen(value) + 2);
+    memcpy(str, name, len);
+    str[len] = '=';
+    strcpy(str + len + 1, value);
+    dropstr(v);
+    v->str = str;
+  }
+
+  if (export && !v->exported) {
+    v->exported = true;
+    nexported++;
+  }
+  if (v->exported)
+    dirty = true;
+}
+
+void setvar(const char *name, const char *value, bool export) {
+  setvarn(name, strlen(name), value, export);
+}
+
+void unsetvar(const char *name) {
+  size_t len = strlen(name);
+  var_t **vp = lookup(name, len, hash(name, len));
+  var_t *v = *vp;
+
+  if (v == NULL)
+    return;
+
+  *vp = v->next;
+  if (v->exported) {
+    nexported--;
+    dirty = true;
+  }
+  nvars--;
+  dropstr(v);
+  free(v);
+}
+
+/* Is the word a valid variable name? */
+bool name_p(const char *word) {
+  size_t n = namelen(word);
+  return n > 0 && word[n] == '\0';
+}
+
+/* Is the word of form NAME=value? */
+bool assignment_p(const char *word) {
+  size_t n = namelen(word);
+  return n > 0 && word[n] == '=';
+}
+
+/* Performs NAME=value assignment. */
+void assign(const char *word, bool export) {
+  size_t n = namelen(word);
+  assert(n > 0 && word[n] == '=');
+  setvarn(word, n, word + n + 1, export);
+}
+
+/* Assignments preceding a builtin last only until it returns. Requests of
+ * the command server push theirs too, so pushes nest. */
+typedef struct saved {
+  char *name;
+  char *value; /* NULL if variable was not set */
+  bool exported;
+} saved_t;
+
+static saved_t *saved = NULL;
+static int nsaved = 0;
+static int *frame = NULL; /* where each push begins in `saved` */
+static int nframes = 0;
+
+void pushvars(char **words, int n) {
+  saved = realloc(saved, sizeof(saved_t) * (nsaved + n));
+  frame = realloc(frame, sizeof(int) * (nframes + 1));
+  frame[nframes++] = nsaved;
+
+  for (int i = 0; i < n; i++, nsaved++) {
+    size_t len = namelen(words[i]);
+    var_t *v = *lookup(words[i], len, hash(words[i], len));
+    saved[nsaved].name = strndup(words[i], len);
+    saved[nsaved].value = v ? strdup(v->str + len + 1) : NULL;
+    saved[nsaved].exported = v ? v->exported : false;
+    assign(words[i], true);
+  }
+}
+
+void popvars(void) {
+  int start = nframes > 0 ? frame[--nframes] : 0;
+
+  /* Restore in reverse order, in case a name was assigned twice. */
+  while (nsaved > start) {
+    saved_t *s = &saved[--nsaved];
+    unsetvar(s->name);
+    if (s->value)
+      setvar(s->name, s->value, s->exported);
+    free(s->name);
+    free(s->value);
+  }
+}
+
+static int strptrcmp(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+/* Print exported variables sorted by name. */
+void printvars(outbuf_t *out) {
+  char **env = getenvp();
+  char **sorted = malloc(sizeof(char *) * nexported);
+
+  memcpy(sorted, env, sizeof(char *) * nexported);
+  qsort(sorted, nexported, sizeof(char *), strptrcmp);
+  for (unsigned i = 0; i < nexported; i++)
+    outbuf_printf(out, "export %s\n", sorted[i]);
+  free(sorted);
+}
+
+/* Returns environment for `execve`. */
+char **getenvp(void) {
+  if (!dirty)
+    return envp;
+
+  envp = realloc(envp, sizeof(char *) * (nexported + 1));
+
+  int n = 0;
+  for (unsigned i = 0; i < nbucket; i++)
+    for (var_t *v = bucket[i]; v; v = v->next)
+      if (v->exported)
+        envp[n++] = v->str;
+  envp[n] = NULL;
+
+  environ = envp;
+  dirty = false;
+
+  while (nstale > 0)
+    free(stale[--nstale]);
+  return envp;
+}
+
+void setstatus(int exitcode) {
+  snprintf(status, sizeof(status), "%d", exitcode);
+}
+
+/* Expands variable references ($NAME, ${NAME}, $? and $$) found in `src`,
+ * except for those within command substitution. If `dst` is NULL only
+ * computes the length of the result. Returns the length of the result, not
+ * counting terminating NUL character. */
+size_t expand(char *dst, const char *src) {
+  size_t n = 0;
+
+  while (*src) {
+    const char *value = NULL;
+    size_t len;
+
+    if (src[0] != '$') {
+      if (dst)
+        dst[n] = *src;
+      n++, src++;
+      continue;
+    }
+
+    /* Command substitution is expanded later, when it's evaluated. */
+    if ((len = substlen(src))) {
+      if (dst)
+        memcpy(dst + n, src, len);
+      n += len, src += len;
+      continue;
+    }
+
+    if (src[1] == '?') {
+      value = status;
+      src += 2;
+    } else if (src[1] == '$') {
+      value = shellpid;
+      src += 2;
+    } else if (src[1] == '{' && (len = namelen(src + 2)) &&
+               src[2 + len] == '}') {
+      value = getvarn(src + 2, len);
+      src += len + 3;
+    } else if ((len = namelen(src + 1))) {
+      value = getvarn(src + 1, len);
+      src += len + 1;
+    } else {
+      /* Not a variable reference, so keep the dollar sign. */
+      if (dst)
+        dst[n] = '$';
+      n++, src++;
+      continue;
+    }
+
+    if (value) {
+      len = strlen(value);
+      if (dst)
+        memcpy(dst + n, value, len);
+      n += len;
+    }
+  }
+
+  if (dst)
+    dst[n] = '\0';
+  return n;
+}
+
+/* Called just at the beginning of shell's life. */
+void initvars(void) {
+  for (char **env = environ; *env; env++) {
+    size_t len = strcspn(*env, "=");
+    if ((*env)[len] == '=')
+      setvarn(*env, len, *env + len + 1, true);
+  }
+  snprintf(shellpid, sizeof(shellpid), "%d", getpid());
+}